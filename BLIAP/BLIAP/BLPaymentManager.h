@@ -75,6 +75,15 @@ typedef void(^BLPaymentFetchProductCompletion)(NSArray<SKProduct *>  * _Nullable
  */
 + (instancetype)sharedManager;
 
+/**
+ * 是否预创建订单, 默认为 NO.
+ *
+ * 开启以后, 用户发起购买时就为这次付款创建订单, 苹果返回这次付款的交易完成时把订单绑定到这笔交易上, 交易完成以后只需要上传收据验证.
+ * 苹果重新投递的旧交易不是这次付款产生的, 即使商品相同也不会绑定.
+ * 没有用上的订单只在本地丢弃, 不发送任何请求.
+ */
+@property(nonatomic, assign) BOOL speculativeOrderCreationEnabled;
+
 /**
  * 是否所有的待验证任务都完成了.
  *
@@ -13,6 +13,8 @@
 #import <StoreKit/StoreKit.h>
 #import "BLPaymentVerifyManager.h"
 #import "BLPaymentTransactionModel.h"
+#import "BLPaymentSpeculativeOrder.h"
+#import "BLPaymentVerifyTransport.h"
 #import "BLWalletCompat.h"
 #import "BLJailbreakDetectTool.h"
 
@@ -38,6 +40,16 @@
  */
 @property(nonatomic, weak, nullable) SKProductsRequest *currentProductRequest;
 
+/**
+ * 预创建的订单, 付款 -> 订单. 按 SKPayment 实例区分, 订单只绑定到由这次付款产生的交易上.
+ */
+@property(nonatomic, strong, nonnull) NSMapTable<SKPayment *, BLPaymentSpeculativeOrder *> *speculativeOrders;
+
+/**
+ * 付款失败以后没有用上的订单, 商品标识 -> 订单, 留给这个商品的下一次付款.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, BLPaymentSpeculativeOrder *> *spareSpeculativeOrders;
+
 @end
 
 NSString *const kBLPaymentManagerKeychainStoreServiceKey = @"com.ibeiliao.payment.attachment.keychain.store.service.key.www";
@@ -73,6 +85,7 @@ static BLPaymentManager *_sharedManager = nil;
     }
     self.verifyManager = nil;
     self.fetchProductCompletion = nil;
+    [self abandonAllSpeculativeOrders];
     [[SKPaymentQueue defaultQueue] removeTransactionObserver:self];
 }
 
@@ -150,7 +163,10 @@ static BLPaymentManager *_sharedManager = nil;
         return;
     }
     
+    // 用户点击购买的时候就预热到验证后台的连接, 开始为这次付款创建订单, 和苹果的付款流程同时进行.
     SKPayment *payment = [SKPayment paymentWithProduct:product];
+    [BLPaymentVerifyTransport.sharedTransport prewarmConnectionIfNeed];
+    [self createSpeculativeOrderIfNeedForPayment:payment];
     [[SKPaymentQueue defaultQueue] addPayment:payment];
 }
 
@@ -214,6 +230,9 @@ static BLPaymentManager *_sharedManager = nil;
 // 交易中.
 - (void)transactionPurchasing:(SKPaymentTransaction *)transaction {
     NSLog(@"交易中...");
+    // 不是通过 -buyProduct:error: 发起的购买, 在这里预热连接, 开始创建订单.
+    [BLPaymentVerifyTransport.sharedTransport prewarmConnectionIfNeed];
+    [self createSpeculativeOrderIfNeedForPayment:transaction.payment];
 }
 
 // 交易成功.
@@ -236,7 +255,7 @@ static BLPaymentManager *_sharedManager = nil;
     
     // 已经在之前验证成功, 但是当验证成功回来从 IAP 取当前这个订单的时候, 取不到, 现在直接将这样的订单关闭掉.
     if ([self checkTransactionDidFinishedFromService:transaction]) {
-        [self finishATransation:transaction];
+        [self finishATransationAfterAllPendingPersistenceFinished:transaction];
         return;
     }
 
@@ -255,6 +274,7 @@ static BLPaymentManager *_sharedManager = nil;
         // [BLHUDManager showToastWithText:@"用户取消交易"];
     }
     
+    [self spareSpeculativeOrderForPayment:transaction.payment];
     [self finishATransation:transaction];
 }
 
@@ -325,6 +345,8 @@ static BLPaymentManager *_sharedManager = nil;
         return;
     }
     
+    // 等待还没有写入 keychain 的修改完成, 避免退出时丢失交易.
+    [self.verifyManager waitUntilAllPendingPersistenceFinished];
     [[SKPaymentQueue defaultQueue] removeTransactionObserver:self];
     self.fetchProductCompletion = nil;
     [self removeNotificationObserver];
@@ -355,7 +377,7 @@ static BLPaymentManager *_sharedManager = nil;
         
         // 已经在之前验证成功, 但是当验证成功回来从 IAP 取当前这个订单的时候, 取不到, 现在直接将这样的订单关闭掉.
         if ([self checkTransactionDidFinishedFromService:transaction]) {
-            [self finishATransation:transaction];
+            [self finishATransationAfterAllPendingPersistenceFinished:transaction];
             return;
         }
         
@@ -417,10 +439,22 @@ static BLPaymentManager *_sharedManager = nil;
         [self.verifyManager updatePaymentTransactionModelStateWithTransactionIdentifier:transactionIdentifier];
     }
     else {
-        [self finishATransation:targetTransaction];
+        [self finishATransationAfterAllPendingPersistenceFinished:targetTransaction];
     }
 }
 
+- (void)finishATransationAfterAllPendingPersistenceFinished:(SKPaymentTransaction *)transaction {
+    // 这笔交易之前的 keychain 修改写入完成以后再 finish, finish 以后苹果不会再返回这笔交易.
+    __weak typeof(self) wself = self;
+    [self.verifyManager performAfterAllPendingPersistenceFinished:^{
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        [sself finishATransation:transaction];
+        
+    }];
+}
+
 - (void)finishATransation:(SKPaymentTransaction *)transaction {
     NSParameterAssert(transaction);
     if (!transaction) {
@@ -444,9 +478,142 @@ static BLPaymentManager *_sharedManager = nil;
     
     // 还没有持久化到验证队列里.
     BLPaymentTransactionModel *transactionModel = [self generateTransactionModelWithPaymentTransaction:transaction];
+    
+    // 这次付款有已经创建好的订单, 绑定到这笔交易上, 验证的时候直接上传收据. 重新投递的旧交易不是这次付款产生的, 不会绑定.
+    BLPaymentSpeculativeOrder *speculativeOrder = [self takeSpeculativeOrderForPayment:transaction.payment];
+    if (speculativeOrder) {
+        transactionModel.orderNo = speculativeOrder.orderNo;
+        transactionModel.priceTagString = speculativeOrder.priceTagString;
+    }
     [self.verifyManager appendPaymentTransactionModel:transactionModel];
 }
 
+
+#pragma mark - Speculative Order
+
+- (NSMapTable<SKPayment *, BLPaymentSpeculativeOrder *> *)speculativeOrders {
+    if (!_speculativeOrders) {
+        // 按实例地址比较付款, 同一个商品的两次付款对应不同的订单.
+        _speculativeOrders = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory capacity:0];
+    }
+    return _speculativeOrders;
+}
+
+- (NSMutableDictionary<NSString *, BLPaymentSpeculativeOrder *> *)spareSpeculativeOrders {
+    if (!_spareSpeculativeOrders) {
+        _spareSpeculativeOrders = [NSMutableDictionary dictionary];
+    }
+    return _spareSpeculativeOrders;
+}
+
+- (void)createSpeculativeOrderIfNeedForPayment:(SKPayment *)payment {
+    NSString *productIdentifier = payment.productIdentifier;
+    if (!self.speculativeOrderCreationEnabled || !self.verifyManager || !productIdentifier.length) {
+        return;
+    }
+    
+    // 这次付款已经有订单了, 不需要再创建.
+    if ([self.speculativeOrders objectForKey:payment]) {
+        return;
+    }
+    
+    [self abandonExpiredSpeculativeOrders];
+    
+    // 之前付款失败没有用上的订单还没过期, 留给这一次付款.
+    BLPaymentSpeculativeOrder *order = self.spareSpeculativeOrders[productIdentifier];
+    if (order) {
+        [self.spareSpeculativeOrders removeObjectForKey:productIdentifier];
+        [self.speculativeOrders setObject:order forKey:payment];
+        return;
+    }
+    
+    order = [[BLPaymentSpeculativeOrder alloc] initWithProductIdentifier:productIdentifier];
+    [self.speculativeOrders setObject:order forKey:payment];
+    __weak typeof(self) wself = self;
+    [order startWithCompletion:^(BLPaymentSpeculativeOrder *speculativeOrder) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        // 创建失败的订单直接丢弃, 交易完成以后由验证队列自己创建订单.
+        if (speculativeOrder.state == BLPaymentSpeculativeOrderStateFailed) {
+            [sself removeSpeculativeOrder:speculativeOrder];
+        }
+        
+    }];
+}
+
+// 取出这次付款可以绑定的订单. 还在创建中的订单不等待, 这笔交易由验证队列自己创建订单.
+- (nullable BLPaymentSpeculativeOrder *)takeSpeculativeOrderForPayment:(SKPayment *)payment {
+    BLPaymentSpeculativeOrder *order = [self.speculativeOrders objectForKey:payment];
+    if (!order) {
+        return nil;
+    }
+    
+    [self.speculativeOrders removeObjectForKey:payment];
+    if (order.state != BLPaymentSpeculativeOrderStateCreated || order.isExpired) {
+        [order abandon];
+        return nil;
+    }
+    return order;
+}
+
+// 付款失败, 还能用的订单留给这个商品的下一次付款, 同一个商品只保留一个.
+- (void)spareSpeculativeOrderForPayment:(SKPayment *)payment {
+    BLPaymentSpeculativeOrder *order = [self.speculativeOrders objectForKey:payment];
+    if (!order) {
+        return;
+    }
+    
+    [self.speculativeOrders removeObjectForKey:payment];
+    BOOL isOrderUsable = order.state == BLPaymentSpeculativeOrderStateCreating || order.state == BLPaymentSpeculativeOrderStateCreated;
+    if (!isOrderUsable || order.isExpired || self.spareSpeculativeOrders[order.productIdentifier]) {
+        [order abandon];
+        return;
+    }
+    self.spareSpeculativeOrders[order.productIdentifier] = order;
+}
+
+- (void)removeSpeculativeOrder:(BLPaymentSpeculativeOrder *)order {
+    for (SKPayment *payment in self.speculativeOrders.keyEnumerator.allObjects) {
+        if ([self.speculativeOrders objectForKey:payment] == order) {
+            [self.speculativeOrders removeObjectForKey:payment];
+        }
+    }
+    if (self.spareSpeculativeOrders[order.productIdentifier] == order) {
+        [self.spareSpeculativeOrders removeObjectForKey:order.productIdentifier];
+    }
+}
+
+// 付款一直没有结果的订单会留在这里, 过期以后丢弃.
+- (void)abandonExpiredSpeculativeOrders {
+    NSMutableArray<BLPaymentSpeculativeOrder *> *expiredOrders = [NSMutableArray array];
+    for (BLPaymentSpeculativeOrder *order in self.speculativeOrders.objectEnumerator) {
+        if (order.isExpired) {
+            [expiredOrders addObject:order];
+        }
+    }
+    for (BLPaymentSpeculativeOrder *order in self.spareSpeculativeOrders.allValues) {
+        if (order.isExpired) {
+            [expiredOrders addObject:order];
+        }
+    }
+    for (BLPaymentSpeculativeOrder *order in expiredOrders) {
+        [order abandon];
+        [self removeSpeculativeOrder:order];
+    }
+}
+
+- (void)abandonAllSpeculativeOrders {
+    for (BLPaymentSpeculativeOrder *order in self.speculativeOrders.objectEnumerator) {
+        [order abandon];
+    }
+    for (BLPaymentSpeculativeOrder *order in self.spareSpeculativeOrders.allValues) {
+        [order abandon];
+    }
+    [self.speculativeOrders removeAllObjects];
+    [self.spareSpeculativeOrders removeAllObjects];
+}
+
 // 获取到对应的收据, 创建需验证模型, 持久化到需验证队列 ✅.
 - (BLPaymentTransactionModel *)generateTransactionModelWithPaymentTransaction:(SKPaymentTransaction *)transaction {
     return [[BLPaymentTransactionModel alloc]
@@ -0,0 +1,93 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, BLPaymentSpeculativeOrderState) { // 预创建订单状态.
+    BLPaymentSpeculativeOrderStateDefault = 0, // 初始化状态.
+    BLPaymentSpeculativeOrderStateCreating = 1, // 正在创建订单.
+    BLPaymentSpeculativeOrderStateCreated = 2, // 订单已经创建, 等待绑定交易.
+    BLPaymentSpeculativeOrderStateFailed = 3, // 创建订单失败.
+    BLPaymentSpeculativeOrderStateAbandoned = 4 // 已经丢弃. 丢弃只在本地进行, 不通知后台, 没有付款的订单由后台自己过期.
+};
+
+@class BLPaymentSpeculativeOrder;
+
+/**
+ * 预创建订单请求结束的回调, 在主线程执行.
+ *
+ * @param order 当前订单, 根据 `state` 判断是否创建成功.
+ */
+typedef void(^BLPaymentSpeculativeOrderCompletion)(BLPaymentSpeculativeOrder *order);
+
+/**
+ * 预创建的订单.
+ *
+ * 用户发起购买的时候就为商品创建订单, 等苹果返回交易完成以后再把订单绑定到这笔交易上,
+ * 这样交易完成以后只需要上传收据验证.
+ */
+@interface BLPaymentSpeculativeOrder : NSObject
+
+/**
+ * 商品标识.
+ */
+@property(nonatomic, copy, readonly) NSString *productIdentifier;
+
+/**
+ * 订单号, 订单创建成功以后才有值.
+ */
+@property(nonatomic, copy, readonly, nullable) NSString *orderNo;
+
+/**
+ * 价格字符串, 订单创建成功以后才有值.
+ */
+@property(nonatomic, copy, readonly, nullable) NSString *priceTagString;
+
+/**
+ * 订单状态.
+ */
+@property(nonatomic, assign, readonly) BLPaymentSpeculativeOrderState state;
+
+/**
+ * 订单是否已经过期, 过期的订单不能再绑定交易.
+ *
+ * @see `BLPaymentSpeculativeOrderTimeToLive`.
+ */
+@property(nonatomic, assign, readonly, getter=isExpired) BOOL expired;
+
+/**
+ * 初始化方法.
+ *
+ * @param productIdentifier 商品标识.
+ *
+ * @return 当前实例.
+ */
+- (instancetype)initWithProductIdentifier:(NSString *)productIdentifier NS_DESIGNATED_INITIALIZER;
+
+/**
+ * 开始创建订单.
+ *
+ * @param completion 请求结束以后的回调, 订单被丢弃以后不再回调.
+ */
+- (void)startWithCompletion:(nullable BLPaymentSpeculativeOrderCompletion)completion;
+
+/**
+ * 丢弃当前订单.
+ *
+ * @warning 只在本地丢弃, 还在进行的请求直接断开, 不发送任何请求通知后台.
+ */
+- (void)abandon;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,167 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentSpeculativeOrder.h"
+#import "BLPaymentVerifyTransport.h"
+#import "BLWalletCompat.h"
+
+// 创建订单请求超时时间, 单位为秒.
+static NSTimeInterval const kBLPaymentSpeculativeOrderCreateOrderTimeoutInterval = 15;
+
+@interface BLPaymentSpeculativeOrder()
+
+/**
+ * 订单号.
+ */
+@property(nonatomic, copy, nullable) NSString *orderNo;
+
+/**
+ * 价格字符串.
+ */
+@property(nonatomic, copy, nullable) NSString *priceTagString;
+
+/**
+ * 订单状态.
+ */
+@property(nonatomic, assign) BLPaymentSpeculativeOrderState state;
+
+/**
+ * 开始创建订单的时间(系统启动时间).
+ */
+@property(nonatomic, assign) NSTimeInterval startTime;
+
+/**
+ * 请求结束以后的回调.
+ */
+@property(nonatomic, copy, nullable) BLPaymentSpeculativeOrderCompletion completion;
+
+/**
+ * 正在进行的请求.
+ */
+@property(nonatomic, strong, nullable) NSURLSessionDataTask *dataTask;
+
+@end
+
+@implementation BLPaymentSpeculativeOrder
+
+- (instancetype)init {
+    NSAssert(NO, @"使用指定的初始化接口来初始化当前类");
+    return [self initWithProductIdentifier:[NSString new]];
+}
+
+- (instancetype)initWithProductIdentifier:(NSString *)productIdentifier {
+    NSParameterAssert(productIdentifier);
+    if (!productIdentifier.length) {
+        return nil;
+    }
+    
+    self = [super init];
+    if (self) {
+        _productIdentifier = [productIdentifier copy];
+        _state = BLPaymentSpeculativeOrderStateDefault;
+    }
+    return self;
+}
+
+- (void)startWithCompletion:(BLPaymentSpeculativeOrderCompletion)completion {
+    if (self.state != BLPaymentSpeculativeOrderStateDefault) {
+        NSLog(@"预创建订单只能开始一次 😢");
+        return;
+    }
+    
+    self.completion = completion;
+    self.state = BLPaymentSpeculativeOrderStateCreating;
+    self.startTime = NSProcessInfo.processInfo.systemUptime;
+    NSLog(@"开始预创建订单");
+    [self sendCreateOrderRequestWithProductIdentifier:self.productIdentifier];
+}
+
+- (void)abandon {
+    self.state = BLPaymentSpeculativeOrderStateAbandoned;
+    self.completion = nil;
+    
+    // 还在进行的请求直接断开, 不通知后台, 没有付款的订单由后台自己过期.
+    [self.dataTask cancel];
+    self.dataTask = nil;
+}
+
+- (BOOL)isExpired {
+    if (self.state == BLPaymentSpeculativeOrderStateDefault) {
+        return NO;
+    }
+    
+    return NSProcessInfo.processInfo.systemUptime - self.startTime > BLPaymentSpeculativeOrderTimeToLive;
+}
+
+
+#pragma mark - Request
+
+- (void)sendCreateOrderRequestWithProductIdentifier:(NSString *)productIdentifier {
+    // 执行创建订单请求. 这时候还没有这笔交易的收据, 不带 md5, 订单在交易完成以后和当时的收据绑定.
+    __weak typeof(self) wself = self;
+    self.dataTask = [BLPaymentVerifyTransport.sharedTransport POST:BLPaymentVerifyCreateOrderPath parameters:@{@"productIdentifier" : productIdentifier} timeoutInterval:kBLPaymentSpeculativeOrderCreateOrderTimeoutInterval completionQueue:nil completion:^(NSDictionary *data, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        sself.dataTask = nil;
+        NSString *orderNo = [data[@"orderNo"] isKindOfClass:[NSString class]] ? data[@"orderNo"] : nil;
+        if (error || !orderNo.length) {
+            [sself handleCreateOrderFailed];
+            return;
+        }
+        
+        NSString *priceTagString = [data[@"priceTagString"] isKindOfClass:[NSString class]] ? data[@"priceTagString"] : nil;
+        [sself handleCreateOrderSuccessedWithOrderNo:orderNo priceTagString:priceTagString];
+        
+    }];
+}
+
+
+#pragma mark - Request Result Handle
+
+- (void)handleCreateOrderSuccessedWithOrderNo:(NSString *)orderNo priceTagString:(NSString *)priceTagString {
+    if (self.state != BLPaymentSpeculativeOrderStateCreating) {
+        return;
+    }
+    
+    NSLog(@"预创建订单成功");
+    self.orderNo = orderNo;
+    self.priceTagString = priceTagString;
+    self.state = BLPaymentSpeculativeOrderStateCreated;
+    [self callCompletion];
+}
+
+- (void)handleCreateOrderFailed {
+    if (self.state != BLPaymentSpeculativeOrderStateCreating) {
+        return;
+    }
+    
+    NSLog(@"预创建订单失败");
+    self.state = BLPaymentSpeculativeOrderStateFailed;
+    [self callCompletion];
+}
+
+
+#pragma mark - Private
+
+- (void)callCompletion {
+    BLPaymentSpeculativeOrderCompletion completion = self.completion;
+    self.completion = nil;
+    if (completion) {
+        completion(self);
+    }
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"productIdentifier: %@, orderNo: %@, state: %@", self.productIdentifier, self.orderNo, @(self.state)];
+}
+
+@end
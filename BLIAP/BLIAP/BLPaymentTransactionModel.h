@@ -14,7 +14,7 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
-@interface BLPaymentTransactionModel : NSObject<NSCoding>
+@interface BLPaymentTransactionModel : NSObject<NSCoding, NSCopying>
 
 #pragma mark - Properties
 
@@ -79,6 +79,30 @@ NS_ASSUME_NONNULL_BEGIN
                     transactionIdentifier:(NSString *)transactionIdentifier
                           transactionDate:(NSDate *)transactionDate;
 
+/**
+ * 从持久化数据初始化.
+ *
+ * 紧凑二进制格式只立即解码头部字段(transactionIdentifier, modelVerifyCount, isTransactionValidFromService), 其他字段第一次访问时才解码.
+ * 初始化时会检查所有字符串的长度前缀, 数据被截断、长度越界或者 productIdentifier 为空时返回 nil.
+ *
+ * @warning: 同时支持紧凑二进制格式(@see `-encodedData`)和旧版本的 NSKeyedArchiver 归档格式, 数据无法解析时返回 nil.
+ *
+ * @param data 持久化数据.
+ */
+- (nullable instancetype)initWithEncodedData:(NSData *)data;
+
+/**
+ * 紧凑的二进制编码, 用于持久化.
+ *
+ * 格式(小端序): magic(2) + version(1) + flags(1) + modelVerifyCount(4) + transactionDate(8)
+ *             + transactionIdentifier + productIdentifier + orderNo + priceTagString + md5.
+ * 字符串为 2 字节长度前缀 + UTF-8 数据, 长度为 0xFFFF 表示 nil.
+ * 头部字段都在固定偏移, transactionIdentifier 是第一个字符串, 不需要解码整个模型就能读取.
+ *
+ * @warning 任意一个字符串的 UTF-8 数据达到 0xFFFF 字节时编码失败, 返回 nil, 不会截断.
+ */
+- (nullable NSData *)encodedData;
+
 @end
 
 NS_ASSUME_NONNULL_END
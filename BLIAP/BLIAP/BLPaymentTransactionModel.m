@@ -11,10 +11,121 @@
 
 #import "BLPaymentTransactionModel.h"
 #import "BLWalletCompat.h"
+#import <pthread.h>
 
 NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验证次数，如果超过这个值就报警。
+
+// 紧凑二进制编码.
+static const uint8_t kBLPaymentTransactionModelCodecMagic[2] = {'B', 'L'};
+static const uint8_t kBLPaymentTransactionModelCodecVersion = 1;
+static const uint16_t kBLPaymentTransactionModelCodecNilLength = 0xFFFF;
+static const uint8_t kBLPaymentTransactionModelCodecFlagValidFromService = 1 << 0;
+// transactionDate 在数据中的固定偏移, 之前的 magic + version + flags + modelVerifyCount 都是定长的头部字段.
+static const NSUInteger kBLPaymentTransactionModelCodecDateOffset = 8;
+
+// 字符串的 UTF-8 数据超过长度前缀能表示的范围时返回 NO, 不截断, 截断会把多字节字符切成无效的 UTF-8.
+static BOOL BLCodecAppendString(NSMutableData *data, NSString *string) {
+    if (!string) {
+        uint16_t length = CFSwapInt16HostToLittle(kBLPaymentTransactionModelCodecNilLength);
+        [data appendBytes:&length length:sizeof(length)];
+        return YES;
+    }
+    
+    NSData *stringData = [string dataUsingEncoding:NSUTF8StringEncoding];
+    if (!stringData || stringData.length >= kBLPaymentTransactionModelCodecNilLength) {
+        return NO;
+    }
+    
+    uint16_t length = CFSwapInt16HostToLittle((uint16_t)stringData.length);
+    [data appendBytes:&length length:sizeof(length)];
+    [data appendData:stringData];
+    return YES;
+}
+
+static BOOL BLCodecReadBytes(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, void *buffer, NSUInteger size) {
+    if (*offset + size > length) {
+        return NO;
+    }
+    memcpy(buffer, bytes + *offset, size);
+    *offset += size;
+    return YES;
+}
+
+static BOOL BLCodecReadString(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, NSString **string) {
+    uint16_t stringLength = 0;
+    if (!BLCodecReadBytes(bytes, length, offset, &stringLength, sizeof(stringLength))) {
+        return NO;
+    }
+    stringLength = CFSwapInt16LittleToHost(stringLength);
+    if (stringLength == kBLPaymentTransactionModelCodecNilLength) {
+        *string = nil;
+        return YES;
+    }
+    if (*offset + stringLength > length) {
+        return NO;
+    }
+    *string = [[NSString alloc] initWithBytes:bytes + *offset length:stringLength encoding:NSUTF8StringEncoding];
+    *offset += stringLength;
+    return *string != nil;
+}
+
+// 只检查字符串的长度前缀是否越界, 不创建字符串.
+static BOOL BLCodecSkipString(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, BOOL *isNil) {
+    uint16_t stringLength = 0;
+    if (!BLCodecReadBytes(bytes, length, offset, &stringLength, sizeof(stringLength))) {
+        return NO;
+    }
+    stringLength = CFSwapInt16LittleToHost(stringLength);
+    *isNil = stringLength == kBLPaymentTransactionModelCodecNilLength;
+    if (*isNil) {
+        return YES;
+    }
+    if (*offset + stringLength > length) {
+        return NO;
+    }
+    *offset += stringLength;
+    return YES;
+}
+
+@interface BLPaymentTransactionModel() {
+    /**
+     * 还没有解码的持久化数据, 非头部字段第一次被访问时才解码. 解码完成以后置为 nil.
+     */
+    NSData *_lazyData;
+    
+    /**
+     * productIdentifier 在 _lazyData 中的偏移.
+     */
+    NSUInteger _lazyStringsOffset;
+    
+    /**
+     * 保护延迟解码.
+     */
+    pthread_mutex_t _lazyLock;
+}
+
+@end
+
 @implementation BLPaymentTransactionModel
 
+@synthesize transactionDate = _transactionDate;
+@synthesize productIdentifier = _productIdentifier;
+@synthesize orderNo = _orderNo;
+@synthesize priceTagString = _priceTagString;
+@synthesize md5 = _md5;
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        pthread_mutex_init(&_lazyLock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lazyLock);
+}
+
 - (NSString *)description {
     NSDateFormatter *formatter = [NSDateFormatter new];
     formatter.dateFormat = @"yyyy-MM-dd hh:mm:ss";
@@ -23,7 +134,7 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
 }
 
 - (instancetype)initWithCoder:(NSCoder *)aDecoder {
-    self = [super init];
+    self = [self init];
     if (self) {
         _productIdentifier = [aDecoder decodeObjectForKey:@"productIdentifier"];
         _transactionIdentifier = [aDecoder decodeObjectForKey:@"transactionIdentifier"];
@@ -48,6 +159,115 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
     [aCoder encodeBool:self.isTransactionValidFromService forKey:@"isTransactionValidFromService"];
 }
 
+- (id)copyWithZone:(NSZone *)zone {
+    BLPaymentTransactionModel *model = [[[self class] allocWithZone:zone] init];
+    pthread_mutex_lock(&_lazyLock);
+    // 还没有解码的数据直接共享给副本, 拷贝不会触发解码.
+    model->_lazyData = _lazyData;
+    model->_lazyStringsOffset = _lazyStringsOffset;
+    model->_productIdentifier = _productIdentifier;
+    model->_transactionDate = _transactionDate;
+    model->_orderNo = _orderNo;
+    model->_priceTagString = _priceTagString;
+    model->_md5 = _md5;
+    pthread_mutex_unlock(&_lazyLock);
+    model->_transactionIdentifier = _transactionIdentifier;
+    model->_modelVerifyCount = _modelVerifyCount;
+    model->_isTransactionValidFromService = _isTransactionValidFromService;
+    return model;
+}
+
+- (instancetype)initWithEncodedData:(NSData *)data {
+    // 先初始化, 下面所有返回 nil 的分支释放当前实例时, dealloc 销毁的都是已经初始化的锁.
+    self = [self init];
+    if (!self) {
+        return nil;
+    }
+    
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    if (length < sizeof(kBLPaymentTransactionModelCodecMagic) || memcmp(bytes, kBLPaymentTransactionModelCodecMagic, sizeof(kBLPaymentTransactionModelCodecMagic)) != 0) {
+        // 旧版本的 NSKeyedArchiver 归档数据.
+        id model = length ? [NSKeyedUnarchiver unarchiveObjectWithData:data] : nil;
+        return [model isKindOfClass:[BLPaymentTransactionModel class]] ? model : nil;
+    }
+    
+    // 这里只解码头部字段(flags, modelVerifyCount, transactionIdentifier), 其他字段第一次访问时才解码.
+    NSUInteger offset = sizeof(kBLPaymentTransactionModelCodecMagic);
+    uint8_t version = 0;
+    uint8_t flags = 0;
+    uint32_t modelVerifyCount = 0;
+    if (!BLCodecReadBytes(bytes, length, &offset, &version, sizeof(version)) || version > kBLPaymentTransactionModelCodecVersion) {
+        return nil;
+    }
+    
+    NSString *transactionIdentifier;
+    BOOL success = BLCodecReadBytes(bytes, length, &offset, &flags, sizeof(flags))
+    && BLCodecReadBytes(bytes, length, &offset, &modelVerifyCount, sizeof(modelVerifyCount));
+    offset += sizeof(uint64_t); // 跳过 transactionDate.
+    success = success && BLCodecReadString(bytes, length, &offset, &transactionIdentifier);
+    if (!success || !transactionIdentifier.length) {
+        return nil;
+    }
+    
+    // 其他字段延迟解码, 这里先检查每个字符串的长度前缀都没有越界, 数据被截断或者损坏时直接返回 nil.
+    // productIdentifier 不能为空, 之后的延迟解码只剩 UTF-8 无效这一种失败.
+    NSUInteger lazyStringsOffset = offset;
+    BOOL isProductIdentifierNil = YES, isNil = YES;
+    success = BLCodecSkipString(bytes, length, &offset, &isProductIdentifierNil)
+    && BLCodecSkipString(bytes, length, &offset, &isNil)
+    && BLCodecSkipString(bytes, length, &offset, &isNil)
+    && BLCodecSkipString(bytes, length, &offset, &isNil);
+    if (!success || isProductIdentifierNil) {
+        return nil;
+    }
+    
+    _lazyData = [data copy];
+    _lazyStringsOffset = lazyStringsOffset;
+    _transactionIdentifier = transactionIdentifier;
+    _modelVerifyCount = CFSwapInt32LittleToHost(modelVerifyCount);
+    _isTransactionValidFromService = (flags & kBLPaymentTransactionModelCodecFlagValidFromService) != 0;
+    return self;
+}
+
+- (NSData *)encodedData {
+    NSMutableData *data = [NSMutableData dataWithCapacity:128];
+    [data appendBytes:kBLPaymentTransactionModelCodecMagic length:sizeof(kBLPaymentTransactionModelCodecMagic)];
+    [data appendBytes:&kBLPaymentTransactionModelCodecVersion length:sizeof(kBLPaymentTransactionModelCodecVersion)];
+    
+    uint8_t flags = self.isTransactionValidFromService ? kBLPaymentTransactionModelCodecFlagValidFromService : 0;
+    [data appendBytes:&flags length:sizeof(flags)];
+    
+    uint32_t modelVerifyCount = CFSwapInt32HostToLittle((uint32_t)MIN(self.modelVerifyCount, UINT32_MAX));
+    [data appendBytes:&modelVerifyCount length:sizeof(modelVerifyCount)];
+    
+    // 非头部字段还没有解码, 说明没有被修改过, 直接拷贝原来的数据.
+    pthread_mutex_lock(&_lazyLock);
+    NSData *lazyData = _lazyData;
+    pthread_mutex_unlock(&_lazyLock);
+    if (lazyData) {
+        [data appendData:[lazyData subdataWithRange:NSMakeRange(kBLPaymentTransactionModelCodecDateOffset, lazyData.length - kBLPaymentTransactionModelCodecDateOffset)]];
+        return data.copy;
+    }
+    
+    NSTimeInterval timeInterval = self.transactionDate.timeIntervalSince1970;
+    uint64_t dateBits;
+    memcpy(&dateBits, &timeInterval, sizeof(dateBits));
+    dateBits = CFSwapInt64HostToLittle(dateBits);
+    [data appendBytes:&dateBits length:sizeof(dateBits)];
+    
+    BOOL success = BLCodecAppendString(data, self.transactionIdentifier)
+    && BLCodecAppendString(data, self.productIdentifier)
+    && BLCodecAppendString(data, self.orderNo)
+    && BLCodecAppendString(data, self.priceTagString)
+    && BLCodecAppendString(data, self.md5);
+    if (!success) {
+        NSLog(@"%@", [NSString stringWithFormat:@"交易数据编码失败, 字符串超过 %@ 字节, transactionIdentifier: %@", @(kBLPaymentTransactionModelCodecNilLength - 1), self.transactionIdentifier]);
+        return nil;
+    }
+    return data.copy;
+}
+
 - (instancetype)initWithProductIdentifier:(NSString *)productIdentifier
                     transactionIdentifier:(NSString *)transactionIdentifier
                           transactionDate:(NSDate *)transactionDate {
@@ -66,7 +286,7 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
         return nil;
     }
     
-    self = [super init];
+    self = [self init];
     if (self) {
         _productIdentifier = productIdentifier;
         _transactionIdentifier = transactionIdentifier;
@@ -88,6 +308,88 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
     }
 }
 
+#pragma mark - Lazy Decoding
+
+- (NSDate *)transactionDate {
+    [self internalDecodeLazyFieldsIfNeed];
+    return _transactionDate;
+}
+
+- (NSString *)productIdentifier {
+    [self internalDecodeLazyFieldsIfNeed];
+    return _productIdentifier;
+}
+
+- (NSString *)orderNo {
+    [self internalDecodeLazyFieldsIfNeed];
+    return _orderNo;
+}
+
+- (void)setOrderNo:(NSString *)orderNo {
+    // 先解码, 否则之后的延迟解码会覆盖新值.
+    [self internalDecodeLazyFieldsIfNeed];
+    _orderNo = [orderNo copy];
+}
+
+- (NSString *)priceTagString {
+    [self internalDecodeLazyFieldsIfNeed];
+    return _priceTagString;
+}
+
+- (void)setPriceTagString:(NSString *)priceTagString {
+    [self internalDecodeLazyFieldsIfNeed];
+    _priceTagString = [priceTagString copy];
+}
+
+- (NSString *)md5 {
+    [self internalDecodeLazyFieldsIfNeed];
+    return _md5;
+}
+
+- (void)setMd5:(NSString *)md5 {
+    [self internalDecodeLazyFieldsIfNeed];
+    _md5 = [md5 copy];
+}
+
+- (void)internalDecodeLazyFieldsIfNeed {
+    pthread_mutex_lock(&_lazyLock);
+    if (!_lazyData) {
+        pthread_mutex_unlock(&_lazyLock);
+        return;
+    }
+    
+    const uint8_t *bytes = _lazyData.bytes;
+    NSUInteger length = _lazyData.length;
+    NSUInteger offset = kBLPaymentTransactionModelCodecDateOffset;
+    uint64_t dateBits = 0;
+    NSString *productIdentifier, *orderNo, *priceTagString, *md5;
+    BOOL success = BLCodecReadBytes(bytes, length, &offset, &dateBits, sizeof(dateBits));
+    offset = _lazyStringsOffset;
+    success = success
+    && BLCodecReadString(bytes, length, &offset, &productIdentifier)
+    && BLCodecReadString(bytes, length, &offset, &orderNo)
+    && BLCodecReadString(bytes, length, &offset, &priceTagString)
+    && BLCodecReadString(bytes, length, &offset, &md5);
+    if (success) {
+        dateBits = CFSwapInt64LittleToHost(dateBits);
+        NSTimeInterval timeInterval;
+        memcpy(&timeInterval, &dateBits, sizeof(timeInterval));
+        
+        _transactionDate = [NSDate dateWithTimeIntervalSince1970:timeInterval];
+        _productIdentifier = productIdentifier;
+        _orderNo = orderNo;
+        _priceTagString = priceTagString;
+        _md5 = md5;
+    }
+    else {
+        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"交易数据损坏, transactionIdentifier: %@", _transactionIdentifier]}];
+        // [BLAssert reportError:error];
+    }
+    _lazyData = nil;
+    pthread_mutex_unlock(&_lazyLock);
+}
+
+
 #pragma mark - Private
 
 - (BOOL)isEqual:(id)object {
@@ -107,7 +409,11 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
 }
 
 - (BOOL)isEqualToModel:(BLPaymentTransactionModel *)object {
-    BOOL isTransactionIdentifierMatch = [self.transactionIdentifier isEqualToString:object.transactionIdentifier];
+    // transactionIdentifier 是头部字段, 不一样时直接返回, 不触发 productIdentifier 和 md5 的延迟解码.
+    if (![self.transactionIdentifier isEqualToString:object.transactionIdentifier]) {
+        return NO;
+    }
+    
     BOOL isProductIdentifierMatch = [self.productIdentifier isEqualToString:object.productIdentifier];
     BOOL isMd5Match;
     if (!self.md5 && !object.md5) {
@@ -116,7 +422,7 @@ NSUInteger const kBLPaymentTransactionModelVerifyWarningCount = 20; // 最多验
     else {
        isMd5Match = [self.md5 isEqualToString:object.md5];
     }
-    return isTransactionIdentifierMatch && isProductIdentifierMatch && isMd5Match;
+    return isProductIdentifierMatch && isMd5Match;
 }
 
 @end
@@ -0,0 +1,56 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 交易收据(不可变).
+ *
+ * 每一个版本的收据只创建一次, base64 编码和 md5 值在初始化时计算好, 所有 task 共享同一个实例.
+ */
+@interface BLPaymentTransactionReceipt : NSObject
+
+/**
+ * 收据原始数据.
+ */
+@property(nonatomic, copy, readonly) NSData *data;
+
+/**
+ * base64 编码以后的收据, 上传给后台验证.
+ */
+@property(nonatomic, copy, readonly) NSString *base64EncodedString;
+
+/**
+ * base64 编码以后的收据的 md5 值, 用来判断收据是否有变动.
+ */
+@property(nonatomic, copy, readonly) NSString *md5;
+
+/**
+ * 初始化方法.
+ *
+ * @warning 收据不能为空.
+ *
+ * @param data 收据原始数据.
+ *
+ * @return 当前实例.
+ */
+- (nullable instancetype)initWithData:(NSData *)data NS_DESIGNATED_INITIALIZER;
+
+/**
+ * 收据是否是同一个版本.
+ */
+- (BOOL)isEqualToData:(NSData *)data;
+
+@end
+
+NS_ASSUME_NONNULL_END
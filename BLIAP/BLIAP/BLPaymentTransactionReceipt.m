@@ -0,0 +1,50 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentTransactionReceipt.h"
+#import "BLWalletCompat.h"
+#import <NSData+MD5Digest.h>
+
+@implementation BLPaymentTransactionReceipt
+
+- (instancetype)init {
+    NSAssert(NO, @"使用指定的初始化接口来初始化当前类");
+    return [self initWithData:[NSData new]];
+}
+
+- (instancetype)initWithData:(NSData *)data {
+    NSParameterAssert(data.length);
+    if (!data.length) {
+        return nil;
+    }
+    
+    self = [super init];
+    if (self) {
+        _data = [data copy];
+        _base64EncodedString = [_data base64EncodedStringWithOptions:NSDataBase64EncodingEndLineWithLineFeed];
+        if (!_base64EncodedString.length) {
+            NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"验证收据为空 crtf: %@", _base64EncodedString]}];
+            // [BLAssert reportError:error];
+        }
+        _md5 = [NSData MD5HexDigest:[_base64EncodedString dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    return self;
+}
+
+- (BOOL)isEqualToData:(NSData *)data {
+    return [self.data isEqualToData:data];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"length: %@, md5: %@", @(self.data.length), self.md5];
+}
+
+@end
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <UIKit/UIKit.h>
+#import "BLPaymentVerifyTask.h"
+
+@class BLPaymentTransactionReceipt;
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, BLPaymentVerifyBatchResult) { // 批量验证里某一笔交易的验证结果.
+    BLPaymentVerifyBatchResultNeedRetry = 0, // 后台没有给出这笔交易的结果, 需要重新验证.
+    BLPaymentVerifyBatchResultValid = 1, // 收据有效.
+    BLPaymentVerifyBatchResultInvalid = 2 // 收据无效.
+};
+
+/**
+ * 批量验证 task.
+ *
+ * 同一个用户所有待验证的交易使用的是同一份收据, 批量验证把已经创建过订单的交易合并成一个请求,
+ * 收据只上传一次, 后台返回的每一笔交易的结果再分发给对应的 task, 走 task 原有的代理回调.
+ */
+@interface BLPaymentVerifyBatchTask : NSObject
+
+/**
+ * 参与批量验证的 task, 都是已经创建过订单, 并且收据没有变动的 task.
+ */
+@property(nonatomic, copy, readonly) NSArray<BLPaymentVerifyTask *> *tasks;
+
+/**
+ * task 状态.
+ */
+@property(nonatomic, assign, readonly) BLPaymentVerifyTaskState taskState;
+
+/**
+ * 收据.
+ */
+@property(nonatomic, strong, readonly) BLPaymentTransactionReceipt *transactionReceipt;
+
+/**
+ * 初始化方法.
+ *
+ * @warning 没有订单号或者收据有变动的 task 需要先创建订单, 不会加入批量验证.
+ *          批量验证的请求结果在参与的 task 的 `completionQueue` 上处理, 这些 task 必须使用同一个队列.
+ *
+ * @param tasks                  候选的 task, 必须都还没有开始.
+ * @param transactionReceipt     交易凭证.
+ *
+ * @return 当前实例.
+ */
+- (instancetype)initWithTasks:(NSArray<BLPaymentVerifyTask *> *)tasks transactionReceipt:(BLPaymentTransactionReceipt *)transactionReceipt NS_DESIGNATED_INITIALIZER;
+
+/**
+ * 开始执行批量验证.
+ *
+ * @warning task 一旦取消, 这个 task 就不能再次调用 -start 方法重新执行了.
+ */
+- (void)start;
+
+/**
+ * 取消批量验证, 同时取消参与批量验证的所有 task.
+ *
+ * @warning task 一旦取消, 这个 task 就不能再次调用 -start 方法重新执行了.
+ */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyBatchTask.h"
+#import "BLPaymentVerifyTask+Private.h"
+#import "BLPaymentTransactionModel.h"
+#import "BLPaymentTransactionReceipt.h"
+#import "BLPaymentVerifyTransport.h"
+#import "BLWalletCompat.h"
+
+// 批量上传收据验证请求超时时间, 单位为秒. 后台要逐笔等苹果服务器的验证结果.
+static NSTimeInterval const kBLPaymentVerifyBatchTaskUploadCertificateTimeoutInterval = 60;
+
+@interface BLPaymentVerifyBatchTask()
+
+/**
+ * 参与批量验证的 task.
+ */
+@property(nonatomic, copy) NSArray<BLPaymentVerifyTask *> *tasks;
+
+/**
+ * task 状态.
+ */
+@property(nonatomic, assign) BLPaymentVerifyTaskState taskState;
+
+/**
+ * 收据.
+ */
+@property(nonatomic, strong, nonnull) BLPaymentTransactionReceipt *transactionReceipt;
+
+/**
+ * 正在进行的请求.
+ */
+@property(nonatomic, strong, nullable) NSURLSessionDataTask *dataTask;
+
+@end
+
+@implementation BLPaymentVerifyBatchTask
+
+- (instancetype)init {
+    NSAssert(NO, @"使用指定的初始化接口来初始化当前类");
+    return [self initWithTasks:@[] transactionReceipt:[[BLPaymentTransactionReceipt alloc] initWithData:[NSData new]]];
+}
+
+- (instancetype)initWithTasks:(NSArray<BLPaymentVerifyTask *> *)tasks transactionReceipt:(BLPaymentTransactionReceipt *)transactionReceipt {
+    NSParameterAssert(tasks);
+    NSParameterAssert(transactionReceipt);
+    if (!tasks || !transactionReceipt) {
+        return nil;
+    }
+    
+    self = [super init];
+    if (self) {
+        _taskState = BLPaymentVerifyTaskStateDefault;
+        _transactionReceipt = transactionReceipt;
+        
+        // 只有已经创建过订单, 并且 md5 值没有变动的交易才能直接上传收据验证.
+        NSString *md5 = transactionReceipt.md5;
+        NSMutableArray<BLPaymentVerifyTask *> *tasksM = [NSMutableArray arrayWithCapacity:tasks.count];
+        for (BLPaymentVerifyTask *task in tasks) {
+            NSParameterAssert(task.taskState == BLPaymentVerifyTaskStateDefault);
+            BLPaymentTransactionModel *model = task.transactionModel;
+            if (model.orderNo.length && [model.md5 isEqualToString:md5]) {
+                [tasksM addObject:task];
+            }
+        }
+        _tasks = tasksM.copy;
+    }
+    return self;
+}
+
+- (void)start {
+    if (self.taskState == BLPaymentVerifyTaskStateCancel) {
+        NSLog(@"尝试调起一个被取消的 task 😢");
+        return;
+    }
+    
+    if (!self.tasks.count) {
+        return;
+    }
+    
+    self.taskState = BLPaymentVerifyTaskStateWaitingForServersResponse;
+    for (BLPaymentVerifyTask *task in self.tasks) {
+        task.taskState = BLPaymentVerifyTaskStateWaitingForServersResponse;
+    }
+    NSLog(@"开始批量上传收据验证, 共 %@ 笔交易", @(self.tasks.count));
+    [self sendBatchUploadCertificateRequest];
+}
+
+- (void)cancel {
+    self.taskState = BLPaymentVerifyTaskStateCancel;
+    for (BLPaymentVerifyTask *task in self.tasks) {
+        [task cancel];
+    }
+    
+    // 执行取消请求, 马上断开连接, 不再占用带宽.
+    [self.dataTask cancel];
+    self.dataTask = nil;
+}
+
+
+#pragma mark - Request
+
+- (void)sendBatchUploadCertificateRequest {
+    // 发送批量上传凭证进行验证请求.
+    // 收据只上传一次, 每一笔交易只带上交易标识和订单号.
+    NSString *receipts = self.transactionReceipt.base64EncodedString;
+    NSMutableArray<NSDictionary<NSString *, NSString *> *> *transactions = [NSMutableArray arrayWithCapacity:self.tasks.count];
+    for (BLPaymentVerifyTask *task in self.tasks) {
+        [transactions addObject:@{
+                                  @"transactionIdentifier" : task.transactionModel.transactionIdentifier,
+                                  @"orderNo" : task.transactionModel.orderNo
+                                  }];
+    }
+    NSDictionary *parameters = @{
+                                 @"receipt" : receipts ?: @"",
+                                 @"md5" : self.transactionReceipt.md5 ?: @"",
+                                 @"transactions" : transactions
+                                 };
+    __weak typeof(self) wself = self;
+    self.dataTask = [BLPaymentVerifyTransport.sharedTransport POST:BLPaymentVerifyBatchUploadCertificatePath parameters:parameters timeoutInterval:kBLPaymentVerifyBatchTaskUploadCertificateTimeoutInterval completionQueue:self.tasks.firstObject.completionQueue completion:^(NSDictionary *data, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        sself.dataTask = nil;
+        if (error) {
+            [sself handleBatchUploadCertificateRequestFailed];
+            return;
+        }
+        
+        // 每一笔交易的结果: {"transactionIdentifier": "", "status": 1, "message": ""}, status 的取值见 `BLPaymentVerifyBatchResult`.
+        NSArray *resultItems = [data[@"results"] isKindOfClass:[NSArray class]] ? data[@"results"] : @[];
+        NSMutableDictionary<NSString *, NSNumber *> *results = [NSMutableDictionary dictionaryWithCapacity:resultItems.count];
+        NSMutableDictionary<NSString *, NSString *> *errorMessages = [NSMutableDictionary dictionary];
+        for (NSDictionary *item in resultItems) {
+            if (![item isKindOfClass:[NSDictionary class]] || ![item[@"transactionIdentifier"] isKindOfClass:[NSString class]]) {
+                continue;
+            }
+            
+            NSString *transactionIdentifier = item[@"transactionIdentifier"];
+            results[transactionIdentifier] = [item[@"status"] respondsToSelector:@selector(unsignedIntegerValue)] ? @([item[@"status"] unsignedIntegerValue]) : @(BLPaymentVerifyBatchResultNeedRetry);
+            if ([item[@"message"] isKindOfClass:[NSString class]]) {
+                errorMessages[transactionIdentifier] = item[@"message"];
+            }
+        }
+        [sself handleBatchVerifyResponseWithResults:results errorMessages:errorMessages];
+        
+    }];
+}
+
+
+#pragma mark - Request Result Handle
+
+- (void)handleBatchVerifyResponseWithResults:(NSDictionary<NSString *, NSNumber *> *)results
+                               errorMessages:(nullable NSDictionary<NSString *, NSString *> *)errorMessages {
+    if (self.taskState == BLPaymentVerifyTaskStateCancel) {
+        return;
+    }
+    
+    NSLog(@"批量验证收到结果");
+    self.taskState = BLPaymentVerifyTaskStateFinished;
+    // 后台没有返回结果的交易按请求失败处理, 等待重新验证.
+    for (BLPaymentVerifyTask *task in self.tasks) {
+        if (task.taskState == BLPaymentVerifyTaskStateCancel) {
+            continue;
+        }
+        
+        NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+        BLPaymentVerifyBatchResult result = [results[transactionIdentifier] unsignedIntegerValue];
+        switch (result) {
+            case BLPaymentVerifyBatchResultValid:
+                [task handleVerifingTransactionValid];
+                break;
+            
+            case BLPaymentVerifyBatchResultInvalid:
+                [task handleVerifingTransactionInvalidWithErrorMessage:errorMessages[transactionIdentifier] ?: @"订单验证失败"];
+                break;
+            
+            case BLPaymentVerifyBatchResultNeedRetry:
+            default:
+                [task handleUploadCertificateRequestFailed];
+                break;
+        }
+    }
+}
+
+- (void)handleBatchUploadCertificateRequestFailed {
+    if (self.taskState == BLPaymentVerifyTaskStateCancel) {
+        return;
+    }
+    
+    NSLog(@"批量验证失败");
+    self.taskState = BLPaymentVerifyTaskStateFinished;
+    for (BLPaymentVerifyTask *task in self.tasks) {
+        if (task.taskState == BLPaymentVerifyTaskStateCancel) {
+            continue;
+        }
+        
+        [task handleUploadCertificateRequestFailed];
+    }
+}
+
+
+#pragma mark - Private
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"tasks: %@, taskState: %@", self.tasks, @(self.taskState)];
+}
+
+@end
@@ -11,7 +11,7 @@
 
 #import <UIKit/UIKit.h>
 
-@class BLPaymentVerifyManager, BLPaymentVerifyTask, BLPaymentTransactionModel, SKPaymentTransaction;
+@class BLPaymentVerifyManager, BLPaymentVerifyTask, BLPaymentTransactionModel, BLPaymentVerifyRetryPolicy, SKPaymentTransaction;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -49,15 +49,50 @@ NS_ASSUME_NONNULL_BEGIN
 @interface BLPaymentVerifyManager : NSObject
 
 /**
- * Delegate.
+ * Delegate, 代理回调都在主线程执行.
+ *
+ * @warning 验证状态机运行在自己的串行队列上, 所有接口都可以在主线程调用, 不会阻塞主线程去调度和持久化.
  */
 @property(nonatomic, weak, nullable) id<BLPaymentVerifyManagerDelegate> delegate;
 
 /**
  * 当前正在验证的 task.
+ *
+ * @warning 有多个 task 同时验证时, 这里是最早开始验证的那一个, 所有正在验证的 task 见 `verifingTasks`.
  */
 @property(nonatomic, strong, readonly, nullable) BLPaymentVerifyTask *currentVerifingTask;
 
+/**
+ * 所有正在验证的 task, 按开始验证的先后排列.
+ */
+@property(nonatomic, copy, readonly) NSArray<BLPaymentVerifyTask *> *verifingTasks;
+
+/**
+ * 最大并发验证数量, 默认为 1, 最小为 1.
+ *
+ * @warning 不论并发数是多少, 同一笔交易同一时间最多只有一个 task 在验证.
+ */
+@property(nonatomic, assign) NSUInteger maxConcurrentVerifyTaskCount;
+
+/**
+ * 是否开启批量验证, 默认为 NO.
+ *
+ * 开启以后, 已经创建过订单的交易合并成一个请求验证, 收据只上传一次, 一个批量请求只占用一个并发名额.
+ */
+@property(nonatomic, assign) BOOL batchVerifyEnabled;
+
+/**
+ * 验证失败以后的重试策略, 默认为 `+[BLPaymentVerifyRetryPolicy defaultPolicy]`.
+ */
+@property(nonatomic, copy) BLPaymentVerifyRetryPolicy *retryPolicy;
+
+/**
+ * 收据刷新或者重新加载任务队列的时候, 没有被打断、继续进行的验证请求数量(累计).
+ *
+ * 这些请求以前会被取消以后重新发送一次. 同一个请求只记一次, 收据刷新时已经在用新收据的请求不记.
+ */
+@property(nonatomic, assign, readonly) NSUInteger savedVerifyRequestCount;
+
 /**
  * userID.
  */
@@ -65,6 +100,8 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  * 持久化到 keychain 的交易.
+ *
+ * @note 读取的是已经写入完成的数据, 不会等待还在排队的写入, 在主线程读取不会阻塞.
  */
 @property (nonatomic, strong, nullable, readonly) NSArray<BLPaymentTransactionModel *> *transactionModelsInKeychain;
 
@@ -112,9 +149,25 @@ NS_ASSUME_NONNULL_BEGIN
 
 /**
  * 某笔交易是否在之前已经和后台验证完成, 如果是就删掉这笔交易.
+ *
+ * @warning 不会阻塞当前线程, 删除是异步提交的. 返回 YES 时要在 `-performAfterAllPendingPersistenceFinished:` 里 finish 这笔交易.
  */
 - (BOOL)paymentTransactionDidFinishFromServiceAndDeleteWhenExisted:(SKPaymentTransaction *)transaction;
 
+/**
+ * 持久化屏障: 阻塞当前线程, 直到之前提交的所有 keychain 修改都已经写入完成.
+ *
+ * @warning 只在必须确认数据已经落盘的时候调用, 比如 App 即将退出.
+ */
+- (void)waitUntilAllPendingPersistenceFinished;
+
+/**
+ * 持久化屏障: 之前提交的所有 keychain 修改都写入完成以后, 在主线程执行 block.
+ *
+ * @param block 写入完成以后的回调.
+ */
+- (void)performAfterAllPendingPersistenceFinished:(dispatch_block_t)block;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -12,21 +12,35 @@
 #import "BLPaymentVerifyManager.h"
 #import "BLWalletKeyChainStore.h"
 #import "BLPaymentTransactionModel.h"
+#import "BLPaymentTransactionReceipt.h"
 #import "BLPaymentVerifyTask.h"
+#import "BLPaymentVerifyBatchTask.h"
+#import "BLPaymentVerifyTaskScheduler.h"
+#import "BLPaymentVerifyRetryPolicy.h"
+#import "BLPaymentVerifyTimerWheel.h"
 #import <AFNetworkReachabilityManager.h>
 #import <StoreKit/StoreKit.h>
 
+typedef void(^BLPaymentVerifyStoreUpdates)(BLWalletTransactionModelsBatch *batch);
+
 @interface BLPaymentVerifyManager()<BLPaymentVerifyTaskDelegate>
 
 /**
- * 操作队列.
+ * 操作队列, 只包含等待验证的 task, 开始验证的 task 从队列中取出, 放进 verifingTasksM.
  */
-@property(nonatomic, strong) NSMutableArray<BLPaymentVerifyTask *> *operationTaskQueue; // 最大并发验证数量为 1.
+@property(nonatomic, strong) BLPaymentVerifyTaskScheduler *operationTaskQueue; // 最大并发验证数量为 maxConcurrentVerifyTaskCount.
+
+/**
+ * 是否正在从 keychain 加载任务队列.
+ *
+ * 任务队列只在启动或者发现不一致的时候完整加载一次, 其他时候都是增量维护: 新交易插入, 有结果的移除, 失败的重新排队.
+ */
+@property(nonatomic, assign, getter=isOperationTaskQueueLoading) BOOL operationTaskQueueLoading;
 
 /**
  * 收据(开始验证之前, 必须保证收据不为空).
  */
-@property(nonatomic, strong, nullable) NSData *transactionReceiptData;
+@property(nonatomic, strong, nullable) BLPaymentTransactionReceipt *transactionReceipt;
 
 /**
  * keychainStore.
@@ -34,9 +48,14 @@
 @property(nonatomic, strong, nonnull) BLWalletKeyChainStore *keychainStore;
 
 /**
- * 当前正在验证的 task.
+ * 正在验证的 task, 按开始验证的先后排列, 数量不超过 maxConcurrentVerifyTaskCount.
+ */
+@property(nonatomic, strong, nonnull) NSMutableArray<BLPaymentVerifyTask *> *verifingTasksM;
+
+/**
+ * 正在进行的批量验证, 其中的 task 同时也在 verifingTasksM 里.
  */
-@property(nonatomic, strong) BLPaymentVerifyTask *currentVerifingTask;
+@property(nonatomic, strong, nonnull) NSMutableArray<BLPaymentVerifyBatchTask *> *verifingBatchTasks;
 
 /**
  * userID.
@@ -48,9 +67,79 @@
  */
 @property(nonatomic, strong, nonnull) AFNetworkReachabilityManager *networkReachabilityManager;
 
+/**
+ * 验证队列(串行), 任务队列的调度、重试和 keychain 修改的提交都在这个队列执行, 只有代理回调和 UI 回到主线程.
+ */
+@property(nonatomic, strong, nonnull) dispatch_queue_t managerQueue;
+
+/**
+ * 持久化队列(串行), 所有 keychain 读写都在这个队列执行, 不阻塞主线程.
+ */
+@property(nonatomic, strong, nonnull) dispatch_queue_t persistenceQueue;
+
+/**
+ * 正在收集的批量修改, 期间对 keychain 的修改都合并到一起, 提交时只写入一次.
+ */
+@property(nonatomic, strong, nullable) NSMutableArray<BLPaymentVerifyStoreUpdates> *pendingStoreUpdates;
+
+/**
+ * 正在收集的批量修改的完成回调.
+ */
+@property(nonatomic, strong, nullable) NSMutableArray<dispatch_block_t> *pendingStoreCompletions;
+
+/**
+ * 重试定时器, 所有还没到重试时间的 task 共用一个时间轮.
+ */
+@property(nonatomic, strong, nonnull) BLPaymentVerifyTimerWheel *retryTimerWheel;
+
+/**
+ * 还没到重试时间的 task, 交易标识 -> task.
+ * 这些 task 停放在时间轮上, 不进入任务队列, 也不占用并发名额, 到期以后才进入任务队列.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, BLPaymentVerifyTask *> *parkedTasks;
+
+/**
+ * 交易标识 -> 上一次的重试间隔, 用来计算下一次的重试间隔.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, NSNumber *> *retryIntervalsByTransactionIdentifier;
+
+/**
+ * 任务队列的版本, 每次重置任务队列都会加一, 用来丢弃过期的异步重置结果.
+ */
+@property(nonatomic, assign) NSUInteger operationTaskQueueGeneration;
+
+/**
+ * 重新加载任务队列期间已经有结果的交易.
+ * 读取 keychain 可能早于删除, 加载完成时要跳过这些交易, 不能重复验证.
+ */
+@property(nonatomic, strong, nullable) NSMutableSet<NSString *> *finishedTransactionIdentifiersWhileLoading;
+
+/**
+ * 没有被打断的验证请求数量. 只在验证队列上修改, 任意线程可以直接读取.
+ */
+@property(atomic, assign) NSUInteger savedVerifyRequestCountM;
+
+/**
+ * verifingTasksM 的不可变副本, 每次修改 verifingTasksM 以后在验证队列上更新, 任意线程可以直接读取.
+ */
+@property(atomic, copy, nonnull) NSArray<BLPaymentVerifyTask *> *verifingTasksSnapshot;
+
+/**
+ * 公开属性的存储. 设置时直接写入, 任意线程可以直接读取, 不需要同步等待验证队列.
+ */
+@property(atomic, assign) NSUInteger maxConcurrentVerifyTaskCountM;
+@property(atomic, assign) BOOL batchVerifyEnabledM;
+@property(atomic, copy, nonnull) BLPaymentVerifyRetryPolicy *retryPolicyM;
+
+/**
+ * 已经记入 savedVerifyRequestCountM 的验证请求(task 或者批量验证), 同一个请求只记一次.
+ */
+@property(nonatomic, strong, nonnull) NSHashTable *savedVerifyRequests;
+
 @end
 
 NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.payment.models.keychain.store.service.key.www";
+static void *kBLPaymentVerifyManagerQueueSpecificKey = &kBLPaymentVerifyManagerQueueSpecificKey;
 @implementation BLPaymentVerifyManager
 
 - (void)dealloc {
@@ -71,8 +160,20 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
     self = [super init];
     if (self) {
         _userid = userid;
-        _currentVerifingTask = nil;
+        _verifingTasksM = [NSMutableArray array];
+        _verifingTasksSnapshot = @[];
+        _verifingBatchTasks = [NSMutableArray array];
+        _maxConcurrentVerifyTaskCountM = 1;
+        _retryPolicyM = [BLPaymentVerifyRetryPolicy defaultPolicy];
+        _managerQueue = dispatch_queue_create("com.ibeiliao.payment.verify.manager.queue", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        dispatch_queue_set_specific(_managerQueue, kBLPaymentVerifyManagerQueueSpecificKey, (__bridge void *)self, NULL);
+        _retryTimerWheel = [[BLPaymentVerifyTimerWheel alloc] initWithTickInterval:1 slotCount:64 queue:_managerQueue];
+        _retryIntervalsByTransactionIdentifier = [NSMutableDictionary dictionary];
+        _parkedTasks = [NSMutableDictionary dictionary];
+        _savedVerifyRequests = [NSHashTable hashTableWithOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality];
         _keychainStore = [BLWalletKeyChainStore keyChainStoreWithService:kBLPaymentVerifyManagerKeychainStoreServiceKey];
+        _persistenceQueue = dispatch_queue_create("com.ibeiliao.payment.verify.persistence.queue", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, 0));
+        [self preloadKeychainStore];
         [self addNotificationObserver];
         [self networkReachabilityByAFN];
     }
@@ -92,18 +193,39 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
         return;
     }
     
-    self.transactionReceiptData = transactionReceiptData;
-    [self resetAllIfNeed];
+    NSData *receiptData = [transactionReceiptData copy];
+    [self performOnManagerQueue:^{
+        
+        // 每一个版本的收据只创建一次, base64 编码和 md5 值只计算一次, 都不在主线程.
+        BOOL isTransactionReceiptChanged = ![self.transactionReceipt isEqualToData:receiptData];
+        if (isTransactionReceiptChanged) {
+            self.transactionReceipt = [[BLPaymentTransactionReceipt alloc] initWithData:receiptData];
+        }
+        if ([self loadOperationTaskQueueIfNeed]) {
+            return;
+        }
+        
+        // 收据有变动, 用新的收据重建内存中的 task, 不需要重新读取 keychain.
+        if (isTransactionReceiptChanged) {
+            [self resetOperationTaskQueueWithTransactionReceiptData];
+        }
+        [self startTasksInOperationQueueIfNeed];
+        
+    }];
 }
 
 - (void)appendPaymentTransactionModel:(BLPaymentTransactionModel *)transactionModel {
-    NSAssert([NSThread isMainThread], @"不能再子线程进行当前操作");
     NSAssert(transactionModel, @"transactionModel 为空");
     if (!transactionModel) {
         return;
     }
     
-    [self internalAppendPaymentTransactionModel:transactionModel];
+    BLPaymentTransactionModel *modelCopy = [transactionModel copy];
+    [self performOnManagerQueue:^{
+        
+        [self internalAppendPaymentTransactionModel:modelCopy];
+        
+    }];
 }
 
 - (BOOL)transactionDidStoreInKeyChainWithTransactionIdentifier:(NSString *)transactionIdentifier {
@@ -112,26 +234,23 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
         return NO;
     }
     
-    NSArray<BLPaymentTransactionModel *> *models = [self.keychainStore bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
-    if (!models.count) {
-        return NO;
-    }
-    
-    for (BLPaymentTransactionModel *model in models) {
-        if ([model.transactionIdentifier isEqualToString:transactionIdentifier]) {
-            return YES;
-        }
-    }
-    return NO;
+    __block BOOL stored = NO;
+    [self readStoreUsingBlock:^(BLWalletKeyChainStore *store) {
+        
+        stored = [store bl_fetchPaymentTransactionModelWithTransactionIdentifier:transactionIdentifier forUser:self.userid] != nil;
+        
+    }];
+    return stored;
 }
 
 - (BOOL)didNeedVerifyQueueClearedForCurrentUser {
     // 所有还未得到验证的交易(持久化的).
-    NSArray<BLPaymentTransactionModel *> *transationModels = [self.keychainStore bl_fetchAllPaymentTransactionModelsSortedArrayUsingComparator:^NSComparisonResult(BLPaymentTransactionModel * obj1, BLPaymentTransactionModel *obj2) {
+    __block NSArray<BLPaymentTransactionModel *> *transationModels = nil;
+    [self readStoreUsingBlock:^(BLWalletKeyChainStore *store) {
         
-        return [obj1.transactionDate compare:obj2.transactionDate]; // 日期升序排序.
+        transationModels = [store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
         
-    } forUser:self.userid error:nil];
+    }];
     
     if (transationModels && transationModels.count > 0) {
         return NO;
@@ -140,11 +259,11 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
 }
 
 - (void)cancelAllTasks {
-    if (self.currentVerifingTask) {
-        [self.currentVerifingTask cancel];
-    }
-    
-    self.operationTaskQueue = nil;
+    [self performOnManagerQueue:^{
+        
+        [self internalCancelAllTasks];
+        
+    }];
 }
 
 - (void)updatePaymentTransactionModelStateWithTransactionIdentifier:(NSString *)transactionIdentifier {
@@ -153,7 +272,15 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
         return;
     }
     
-    [self.keychainStore bl_updatePaymentTransactionModelStateWithTransactionIdentifier:transactionIdentifier isTransactionValidFromService:YES forUser:self.userid];
+    [self performOnManagerQueue:^{
+        
+        [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+            
+            [batch updatePaymentTransactionModelStateWithTransactionIdentifier:transactionIdentifier isTransactionValidFromService:YES];
+            
+        } completion:nil];
+        
+    }];
 }
 
 - (BOOL)paymentTransactionDidFinishFromServiceAndDeleteWhenExisted:(SKPaymentTransaction *)transaction {
@@ -162,123 +289,309 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
         return NO;
     }
     
-    NSArray<BLPaymentTransactionModel *> *models = [self.keychainStore bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
-    if (!models.count) {
+    if (!transaction.transactionIdentifier) {
         return NO;
     }
     
-    for (BLPaymentTransactionModel *model in models) {
-        if (model.isTransactionValidFromService && [model.transactionIdentifier isEqualToString:transaction.transactionIdentifier]) {
-            [self.keychainStore bl_deletePaymentTransactionModelWithTransactionIdentifier:transaction.transactionIdentifier forUser:self.userid];
+    NSString *transactionIdentifier = transaction.transactionIdentifier;
+    __block BLPaymentTransactionModel *model = nil;
+    [self readStoreUsingBlock:^(BLWalletKeyChainStore *store) {
+        
+        model = [store bl_fetchPaymentTransactionModelWithTransactionIdentifier:transactionIdentifier forUser:self.userid];
+        
+    }];
+    if (!model.isTransactionValidFromService) {
+        return NO;
+    }
+    
+    // 删除异步提交, 不阻塞调用方. 调用方要在 `-performAfterAllPendingPersistenceFinished:` 里 finish 这笔交易, finish 以后苹果不会再返回这笔交易.
+    [self performOnManagerQueue:^{
+        
+        [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+            
+            [batch deletePaymentTransactionModelWithTransactionIdentifier:transactionIdentifier];
+            
+        } completion:nil];
+        
+    }];
 #if FB_TWEAK_ENABLED
 #else
-            NSString *errorString = [NSString stringWithFormat:@"出现订单在后台验证成功, 但是从 IAP 的未完成订单里取不到这比交易的错误 transactionIdentifier: %@, 但是后来苹果返回了这笔订单, 已经将这个交易从 keychain 中删除了", transaction.transactionIdentifier];
-            NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : errorString}];
-            // [BLAssert reportError:error];
+    NSString *errorString = [NSString stringWithFormat:@"出现订单在后台验证成功, 但是从 IAP 的未完成订单里取不到这比交易的错误 transactionIdentifier: %@, 但是后来苹果返回了这笔订单, 已经将这个交易从 keychain 中删除了", transaction.transactionIdentifier];
+    NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : errorString}];
+    // [BLAssert reportError:error];
 #endif
-            return YES;
-        }
-    }
-    return NO;
+    return YES;
 }
 
 - (NSArray<BLPaymentTransactionModel *> *)transactionModelsInKeychain {
-    return [self.keychainStore bl_fetchAllPaymentTransactionModelsForUser:self.userid
-                                                                    error:nil];
+    __block NSArray<BLPaymentTransactionModel *> *models = nil;
+    [self readStoreUsingBlock:^(BLWalletKeyChainStore *store) {
+        
+        models = [store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
+        
+    }];
+    return models;
+}
+
+- (void)waitUntilAllPendingPersistenceFinished {
+    NSAssert(![self isOnManagerQueue], @"不能在验证队列等待持久化完成");
+    // 先等验证队列上的修改都提交到持久化队列, 再等持久化队列写入完成.
+    dispatch_sync(self.managerQueue, ^{
+        
+        NSAssert(!self.pendingStoreUpdates, @"批量修改还没有提交");
+        
+    });
+    dispatch_sync(self.persistenceQueue, ^{});
+}
+
+- (void)performAfterAllPendingPersistenceFinished:(dispatch_block_t)block {
+    NSParameterAssert(block);
+    if (!block) {
+        return;
+    }
+    
+    [self performOnManagerQueue:^{
+        
+        dispatch_async(self.persistenceQueue, ^{
+            
+            dispatch_async(dispatch_get_main_queue(), block);
+            
+        });
+        
+    }];
+}
+
+// 以下属性都直接读取, 不同步等待验证队列, 在主线程读取不会被正在进行的验证或者写入阻塞.
+
+- (BLPaymentVerifyTask *)currentVerifingTask {
+    return self.verifingTasksSnapshot.firstObject;
+}
+
+- (NSArray<BLPaymentVerifyTask *> *)verifingTasks {
+    return self.verifingTasksSnapshot;
+}
+
+- (NSUInteger)savedVerifyRequestCount {
+    return self.savedVerifyRequestCountM;
+}
+
+- (NSUInteger)maxConcurrentVerifyTaskCount {
+    return self.maxConcurrentVerifyTaskCountM;
+}
+
+- (void)setMaxConcurrentVerifyTaskCount:(NSUInteger)maxConcurrentVerifyTaskCount {
+    NSParameterAssert(maxConcurrentVerifyTaskCount > 0);
+    self.maxConcurrentVerifyTaskCountM = MAX(maxConcurrentVerifyTaskCount, 1);
+    [self performOnManagerQueue:^{
+        
+        // 并发数变大以后, 空出来的名额马上用来验证队列里的 task.
+        [self startTasksInOperationQueueIfNeed];
+        
+    }];
+}
+
+- (BOOL)batchVerifyEnabled {
+    return self.batchVerifyEnabledM;
+}
+
+- (void)setBatchVerifyEnabled:(BOOL)batchVerifyEnabled {
+    self.batchVerifyEnabledM = batchVerifyEnabled;
+    [self performOnManagerQueue:^{
+        
+        [self startTasksInOperationQueueIfNeed];
+        
+    }];
+}
+
+- (BLPaymentVerifyRetryPolicy *)retryPolicy {
+    return self.retryPolicyM;
+}
+
+- (void)setRetryPolicy:(BLPaymentVerifyRetryPolicy *)retryPolicy {
+    NSParameterAssert(retryPolicy);
+    if (!retryPolicy) {
+        return;
+    }
+    
+    self.retryPolicyM = retryPolicy;
 }
 
 
 #pragma mark - BLPaymentVerifyTaskDelegate
 
+// task 的回调可能来自任意线程, 都切到验证队列处理.
 - (void)paymentVerifyTaskDidReceiveResponseReceiptValid:(BLPaymentVerifyTask *)task {
-    if (![self inspectTask:task isCurrentVerifyTask:self.currentVerifingTask]) {
-        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+    [self performOnManagerQueue:^{
+        
+        [self internalPaymentVerifyTaskDidReceiveResponseReceiptValid:task];
+        
+    }];
+}
+
+- (void)paymentVerifyTaskDidReceiveResponseReceiptInvalid:(BLPaymentVerifyTask *)task {
+    [self performOnManagerQueue:^{
+        
+        [self internalPaymentVerifyTaskDidReceiveResponseReceiptInvalid:task];
+        
+    }];
+}
+
+- (void)paymentVerifyTaskUploadCertificateRequestFailed:(BLPaymentVerifyTask *)task {
+    [self performOnManagerQueue:^{
+        
+        [self internalPaymentVerifyTaskUploadCertificateRequestFailed:task];
+        
+    }];
+}
+
+- (void)paymentVerifyTaskCreateOrderRequestFailed:(BLPaymentVerifyTask *)task {
+    [self performOnManagerQueue:^{
+        
+        [self internalPaymentVerifyTaskCreateOrderRequestFailed:task];
+        
+    }];
+}
+
+- (void)paymentVerifyTaskDidReceiveCreateOrderResponse:(BLPaymentVerifyTask *)task
+                                               orderNo:(NSString *)orderNo
+                                        priceTagString:(nullable NSString *)priceTagString
+                                                   md5:(nonnull NSString *)md5 {
+    [self performOnManagerQueue:^{
+        
+        [self internalPaymentVerifyTaskDidReceiveCreateOrderResponse:task orderNo:orderNo priceTagString:priceTagString md5:md5];
+        
+    }];
+}
+
+
+#pragma mark - Task Response
+
+- (void)internalPaymentVerifyTaskDidReceiveResponseReceiptValid:(BLPaymentVerifyTask *)task {
+    if (![self inspectTaskIsVerifing:task]) {
         return;
     }
     // [BLHUDManager showToastWithText:@"支付成功"];
     
-    // 通知代理将改 transactionIdentifier 的 transaction finish 掉.
-    if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManager:paymentTransactionVerifyValid:)]) {
-        [self.delegate paymentVerifyManager:self paymentTransactionVerifyValid:task.transactionModel.transactionIdentifier];
-    }
-    
+    // 先提交删除, 代理收到回调以后设置的持久化屏障一定排在删除之后.
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    NSString *priceTagString = task.transactionModel.priceTagString;
     [self removeFinishedTask:task];
-    self.currentVerifingTask = nil;
-    
-    NSString *alertString = [NSString stringWithFormat:@"您已成功充值 %@ 元", task.transactionModel.priceTagString];
-    UIAlertView *alertView = [[UIAlertView alloc] initWithTitle:alertString message:nil delegate:self cancelButtonTitle:@"OK" otherButtonTitles:nil];
-    [alertView show];
+    [self performOnMainQueue:^{
+        
+        // 通知代理将改 transactionIdentifier 的 transaction finish 掉.
+        if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManager:paymentTransactionVerifyValid:)]) {
+            [self.delegate paymentVerifyManager:self paymentTransactionVerifyValid:transactionIdentifier];
+        }
+        
+        NSString *alertString = priceTagString.length ? [NSString stringWithFormat:@"您已成功充值 %@ 元", priceTagString] : @"您已成功充值";
+        UIAlertView *alertView = [[UIAlertView alloc] initWithTitle:alertString message:nil delegate:self cancelButtonTitle:@"OK" otherButtonTitles:nil];
+        [alertView show];
+        
+    }];
     
     // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    [self finishVerifingTask:task];
+    [self startTasksInOperationQueueIfNeed];
 }
 
-- (void)paymentVerifyTaskDidReceiveResponseReceiptInvalid:(BLPaymentVerifyTask *)task {
-    if (![self inspectTask:task isCurrentVerifyTask:self.currentVerifingTask]) {
-        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+- (void)internalPaymentVerifyTaskDidReceiveResponseReceiptInvalid:(BLPaymentVerifyTask *)task {
+    if (![self inspectTaskIsVerifing:task]) {
         return;
     }
     
-    // 通知代理将改 transactionIdentifier 的 transaction finish 掉.
-    if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManager:paymentTransactionVerifyInvalid:)]) {
-        [self.delegate paymentVerifyManager:self paymentTransactionVerifyInvalid:task.transactionModel.transactionIdentifier];
-    }
-    
+    // 先提交删除, 代理收到回调以后设置的持久化屏障一定排在删除之后.
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
     [self removeFinishedTask:task];
-    self.currentVerifingTask = nil;
+    [self performOnMainQueue:^{
+        
+        // 通知代理将改 transactionIdentifier 的 transaction finish 掉.
+        if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManager:paymentTransactionVerifyInvalid:)]) {
+            [self.delegate paymentVerifyManager:self paymentTransactionVerifyInvalid:transactionIdentifier];
+        }
+        
+    }];
     
     // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    [self finishVerifingTask:task];
+    [self startTasksInOperationQueueIfNeed];
 }
 
-- (void)paymentVerifyTaskUploadCertificateRequestFailed:(BLPaymentVerifyTask *)task{
-    if (![self inspectTask:task isCurrentVerifyTask:self.currentVerifingTask]) {
-        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+- (void)internalPaymentVerifyTaskUploadCertificateRequestFailed:(BLPaymentVerifyTask *)task {
+    if (![self inspectTaskIsVerifing:task]) {
         return;
     }
     
     // 通知代理, 此时应该刷新收据数据.
-    if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManagerRequestFailed:)]) {
-        [self.delegate paymentVerifyManagerRequestFailed:self];
-    }
+    [self performOnMainQueue:^{
+        
+        if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyManagerRequestFailed:)]) {
+            [self.delegate paymentVerifyManagerRequestFailed:self];
+        }
+        
+    }];
     
-    // 给已经验证过一次的失败的交易打上等待重新验证的标识.
-    [self.keychainStore bl_updatePaymentModelVerifyCountWithTransactionIdentifier:task.transactionModel.transactionIdentifier modelVerifyCount:task.transactionModel.modelVerifyCount + 1  forUser:self.userid];
-    self.currentVerifingTask = nil;
+    [self retryFailedTask:task];
     
     // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    [self startTasksInOperationQueueIfNeed];
 }
 
-- (void)paymentVerifyTaskCreateOrderRequestFailed:(BLPaymentVerifyTask *)task {
-    if (![self inspectTask:task isCurrentVerifyTask:self.currentVerifingTask]) {
-        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+- (void)internalPaymentVerifyTaskCreateOrderRequestFailed:(BLPaymentVerifyTask *)task {
+    if (![self inspectTaskIsVerifing:task]) {
         return;
     }
     
-    self.currentVerifingTask = nil;
+    // 创建订单失败和上传收据失败一样计入验证次数, 后台一直创建不了订单的交易同样受最多验证次数限制.
+    [self retryFailedTask:task];
+    
     // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    [self startTasksInOperationQueueIfNeed];
 }
 
-- (void)paymentVerifyTaskDidReceiveCreateOrderResponse:(BLPaymentVerifyTask *)task
-                                               orderNo:(NSString *)orderNo
-                                        priceTagString:(NSString *)priceTagString
-                                                   md5:(nonnull NSString *)md5 {
-    if (![self inspectTask:task isCurrentVerifyTask:self.currentVerifingTask]) {
-        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+// 请求失败的 task 验证次数加一, 按重试策略退避以后重新排队.
+- (void)retryFailedTask:(BLPaymentVerifyTask *)task {
+    // 给已经验证过一次的失败的交易打上等待重新验证的标识.
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    NSUInteger modelVerifyCount = task.transactionModel.modelVerifyCount + 1;
+    [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+        
+        [batch updatePaymentModelVerifyCountWithTransactionIdentifier:transactionIdentifier modelVerifyCount:modelVerifyCount];
+        
+    } completion:nil];
+    [self finishVerifingTask:task];
+    
+    // 带着新的验证次数重新排队. 超过最多验证次数的交易本次启动不再重试, 仍然保留在 keychain 里, 下次启动重新加载.
+    if ([self.retryPolicy shouldRetryAfterAttemptCount:modelVerifyCount]) {
+        BLPaymentTransactionModel *transactionModel = [task.transactionModel copy];
+        transactionModel.modelVerifyCount = modelVerifyCount;
+        [self enqueueTaskWithTransactionModel:transactionModel];
+    }
+    else {
+        NSString *errorString = [NSString stringWithFormat:@"交易验证次数超过上限, 本次启动不再重试 transactionIdentifier: %@, modelVerifyCount: %@", transactionIdentifier, @(modelVerifyCount)];
+        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : errorString}];
+        // [BLAssert reportError:error];
+    }
+}
+
+- (void)internalPaymentVerifyTaskDidReceiveCreateOrderResponse:(BLPaymentVerifyTask *)task
+                                                       orderNo:(NSString *)orderNo
+                                                priceTagString:(nullable NSString *)priceTagString
+                                                           md5:(NSString *)md5 {
+    if (![self inspectTaskIsVerifing:task]) {
         return;
     }
     
-    [self.keychainStore bl_savePaymentTransactionModelWithTransactionIdentifier:task.transactionModel.transactionIdentifier
-                                                                        orderNo:orderNo
-                                                                 priceTagString:priceTagString
-                                                                            md5:md5
-                                                                        forUser:self.userid];
-    self.currentVerifingTask = nil;
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+        
+        [batch savePaymentTransactionModelWithTransactionIdentifier:transactionIdentifier
+                                                            orderNo:orderNo
+                                                     priceTagString:priceTagString
+                                                                md5:md5];
+        
+    } completion:nil];
     
-    // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    // task 已经接着上传收据, 继续占用并发名额, 不需要重新排队.
 }
 
 
@@ -303,7 +616,18 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
 
 - (void)didReceiveClearAllUnfinishedTransiactionNotification {
     if (self.userid) {
-        [self.keychainStore bl_deleteAllPaymentTransactionModelsIfNeedForUser:self.userid];
+        NSString *userid = self.userid;
+        [self performOnManagerQueue:^{
+            
+            dispatch_async(self.persistenceQueue, ^{
+                
+                [self.keychainStore bl_deleteAllPaymentTransactionModelsIfNeedForUser:userid];
+                
+            });
+            // keychain 已经清空, 内存中的任务队列也跟着丢弃, 下次需要的时候重新加载.
+            [self internalCancelAllTasks];
+            
+        }];
     }
 }
 
@@ -321,19 +645,19 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
             case AFNetworkReachabilityStatusUnknown:
                 NSLog(@"未知");
                 break;
-                
+            
             case AFNetworkReachabilityStatusNotReachable:
                 NSLog(@"没有网络");
                 break;
-                
+            
             case AFNetworkReachabilityStatusReachableViaWWAN:
                 [sself networkEnable];
                 break;
-                
+            
             case AFNetworkReachabilityStatusReachableViaWiFi:
                 [sself networkEnable];
                 break;
-                
+            
             default:
                 break;
         }
@@ -342,64 +666,437 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
     [self.networkReachabilityManager startMonitoring];
 }
 
+// 网络状态在主线程回调, 切到验证队列再开始任务.
 - (void)networkEnable {
-    // 执行下一条任务.
-    [self startNextTaskIfNeed];
+    [self performOnManagerQueue:^{
+        
+        if ([self loadOperationTaskQueueIfNeed]) {
+            return;
+        }
+        
+        // 执行下一条任务.
+        [self startTasksInOperationQueueIfNeed];
+        
+    }];
+}
+
+
+#pragma mark - Queue
+
+- (BOOL)isOnManagerQueue {
+    return dispatch_get_specific(kBLPaymentVerifyManagerQueueSpecificKey) == (__bridge void *)self;
+}
+
+// 在验证队列异步执行.
+- (void)performOnManagerQueue:(dispatch_block_t)block {
+    dispatch_async(self.managerQueue, block);
+}
+
+// 在验证队列同步执行, 已经在验证队列上时直接执行. 验证队列从不同步等待主线程, 所以主线程可以同步等待验证队列.
+- (void)performSyncOnManagerQueue:(NS_NOESCAPE dispatch_block_t)block {
+    if ([self isOnManagerQueue]) {
+        block();
+        return;
+    }
+    
+    dispatch_sync(self.managerQueue, block);
+}
+
+// 代理回调和 UI 只在主线程执行.
+- (void)performOnMainQueue:(dispatch_block_t)block {
+    dispatch_async(dispatch_get_main_queue(), block);
 }
 
 
 #pragma mark - Private
 
-- (BOOL)inspectTask:(BLPaymentVerifyTask *)task isCurrentVerifyTask:(BLPaymentVerifyTask *)currentVerifyTask {
-    NSAssert([NSThread isMainThread], @"不能再子线程进行当前操作");
-    NSAssert([currentVerifyTask isEqual:task], @"致命错误 😢, 当前的响应结果不是正在进行验证的收据的响应");
-    NSAssert([self.operationTaskQueue containsObject:task], @"致命错误 😢, 当前的 task 已经不在 task 队列中");
-    return [currentVerifyTask isEqual:task];
+- (BOOL)inspectTaskIsVerifing:(BLPaymentVerifyTask *)task {
+    NSAssert([self isOnManagerQueue], @"只能在验证队列进行当前操作");
+    // 已经取消的 task 迟到的响应直接丢弃, 不能影响其他正在验证的 task.
+    if (task.taskState == BLPaymentVerifyTaskStateCancel) {
+        return NO;
+    }
+    
+    BOOL isVerifing = [self.verifingTasksM indexOfObjectIdenticalTo:task] != NSNotFound;
+    NSAssert(isVerifing, @"致命错误 😢, 当前的响应结果不是正在进行验证的收据的响应");
+    NSAssert(![self.operationTaskQueue taskWithTransactionIdentifier:task.transactionModel.transactionIdentifier], @"致命错误 😢, 正在验证的交易同时还在 task 队列中");
+    if (!isVerifing) {
+        [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+    }
+    return isVerifing;
+}
+
+- (BOOL)isVerifingTransactionWithIdentifier:(NSString *)transactionIdentifier {
+    for (BLPaymentVerifyTask *task in self.verifingTasksM) {
+        if ([task.transactionModel.transactionIdentifier isEqualToString:transactionIdentifier]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)cancelAllVerifingTasks {
+    for (BLPaymentVerifyBatchTask *batchTask in self.verifingBatchTasks) {
+        [batchTask cancel];
+    }
+    [self.verifingBatchTasks removeAllObjects];
+    for (BLPaymentVerifyTask *task in self.verifingTasksM) {
+        [task cancel];
+    }
+    [self.verifingTasksM removeAllObjects];
+    [self publishVerifingTasks];
 }
 
+// 每次修改 verifingTasksM 以后调用, 更新给其他线程读取的副本.
+- (void)publishVerifingTasks {
+    self.verifingTasksSnapshot = self.verifingTasksM;
+}
+
+// 正在进行的验证请求数量, 一个批量验证请求只占用一个并发名额.
+- (NSUInteger)verifingRequestCount {
+    NSUInteger count = self.verifingTasksM.count;
+    for (BLPaymentVerifyBatchTask *batchTask in self.verifingBatchTasks) {
+        NSUInteger verifingCount = [self verifingTaskCountInBatchTask:batchTask];
+        count = count - verifingCount + (verifingCount ? 1 : 0);
+    }
+    return count;
+}
+
+- (NSUInteger)verifingTaskCountInBatchTask:(BLPaymentVerifyBatchTask *)batchTask {
+    NSUInteger count = 0;
+    for (BLPaymentVerifyTask *task in batchTask.tasks) {
+        if ([self.verifingTasksM indexOfObjectIdenticalTo:task] != NSNotFound) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (void)internalCancelAllTasks {
+    [self cancelAllVerifingTasks];
+    [self removeAllParkedTasks];
+    self.operationTaskQueue = nil;
+    self.operationTaskQueueGeneration++;
+    self.operationTaskQueueLoading = NO;
+    self.finishedTransactionIdentifiersWhileLoading = nil;
+}
+
+// 状态已经不一致, 只有这里会打断正在验证的 task, 然后从 keychain 重新加载.
 - (void)cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed {
+    [self cancelAllVerifingTasks];
     [self internalStartPaymentTransactionVerifing];
 }
 
 - (void)removeFinishedTask:(BLPaymentVerifyTask *)task {
     // 验证有结果, 将该条凭证数据从 keychain 里面删除掉.
-    [self.keychainStore bl_deletePaymentTransactionModelWithTransactionIdentifier:task.transactionModel.transactionIdentifier forUser:self.userid];
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+        
+        [batch deletePaymentTransactionModelWithTransactionIdentifier:transactionIdentifier];
+        
+    } completion:nil];
     NSLog(@"订单验证成功后删除 keychain 数据成功");
+    [self.finishedTransactionIdentifiersWhileLoading addObject:transactionIdentifier];
     // 将当前任务从队列中移除掉.
-    [self.operationTaskQueue removeObject:task];
+    [self.operationTaskQueue removeTaskWithTransactionIdentifier:transactionIdentifier];
+    [self removeParkedTaskWithTransactionIdentifier:transactionIdentifier];
+    [self.operationTaskQueue forgetTransactionWithIdentifier:transactionIdentifier];
+    [self.retryIntervalsByTransactionIdentifier removeObjectForKey:transactionIdentifier];
 }
 
-- (void)startNextTaskIfNeed {
-    // 直接重置的原因是, 防止当前是在重试验证, 此时新进来交易.
-    // 可能出现新的交易一直得不到验证, 一直在重复验证那些已经验证过, 但是失败的交易.
-    [self internalStartPaymentTransactionVerifing];
+- (void)finishVerifingTask:(BLPaymentVerifyTask *)task {
+    // 释放 task 占用的并发名额. 正在验证的交易不会再进入队列, 这里的移除只是保证同一笔交易不会留下两个 task.
+    // 需要重新验证的交易由调用方重新排队.
+    [self.verifingTasksM removeObjectIdenticalTo:task];
+    [self publishVerifingTasks];
+    [self.operationTaskQueue removeTaskWithTransactionIdentifier:task.transactionModel.transactionIdentifier];
+    [self removeParkedTaskWithTransactionIdentifier:task.transactionModel.transactionIdentifier];
+    
+    // 批量验证里的 task 都有了结果, 批量验证才算结束.
+    for (BLPaymentVerifyBatchTask *batchTask in self.verifingBatchTasks.copy) {
+        if (![self verifingTaskCountInBatchTask:batchTask]) {
+            [self.verifingBatchTasks removeObjectIdenticalTo:batchTask];
+        }
+    }
+}
+
+- (BLPaymentVerifyTask *)taskWithTransactionModel:(BLPaymentTransactionModel *)transactionModel {
+    NSParameterAssert(self.transactionReceipt);
+    BLPaymentVerifyTask *task = [[BLPaymentVerifyTask alloc] initWithPaymentTransactionModel:transactionModel transactionReceipt:self.transactionReceipt];
+    task.delegate = self;
+    // 请求结果直接在验证队列上处理, task 的状态只在验证队列上修改.
+    task.completionQueue = self.managerQueue;
+    return task;
+}
+
+// 重新验证的交易, 需要按重试策略退避一段时间以后才能开始验证.
+- (void)enqueueTaskWithTransactionModel:(BLPaymentTransactionModel *)transactionModel {
+    NSTimeInterval nextEligibleTime = NSProcessInfo.processInfo.systemUptime;
+    if (transactionModel.modelVerifyCount > 0) {
+        nextEligibleTime += [self nextRetryIntervalForTransactionIdentifier:transactionModel.transactionIdentifier];
+    }
+    [self enqueueTaskWithTransactionModel:transactionModel nextEligibleTime:nextEligibleTime];
+}
+
+- (void)enqueueTaskWithTransactionModel:(BLPaymentTransactionModel *)transactionModel nextEligibleTime:(NSTimeInterval)nextEligibleTime {
+    BLPaymentVerifyTask *task = [self taskWithTransactionModel:transactionModel];
+    NSTimeInterval interval = nextEligibleTime - NSProcessInfo.processInfo.systemUptime;
+    if (interval > 0) {
+        [self parkTask:task afterInterval:interval nextEligibleTime:nextEligibleTime];
+        return;
+    }
+    
+    // 新的交易总是排在重新验证的交易前面, 不会一直在重复验证那些已经验证过, 但是失败的交易.
+    [self.operationTaskQueue addTask:task nextEligibleTime:nextEligibleTime];
+}
+
+// 还没到重试时间的 task 停放在时间轮上, 任务队列里只有现在就可以开始验证的 task.
+// 这样新的交易不会排在一个正在等待重试的 task 后面, 白白等待退避时间.
+- (void)parkTask:(BLPaymentVerifyTask *)task afterInterval:(NSTimeInterval)interval nextEligibleTime:(NSTimeInterval)nextEligibleTime {
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    self.parkedTasks[transactionIdentifier] = task;
+    __weak typeof(self) wself = self;
+    [self.retryTimerWheel scheduleTimerWithIdentifier:transactionIdentifier afterInterval:interval handler:^{
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        // 停放期间收据可能有变动, 所以到期的时候再取 task.
+        BLPaymentVerifyTask *parkedTask = sself.parkedTasks[transactionIdentifier];
+        [sself.parkedTasks removeObjectForKey:transactionIdentifier];
+        if (!parkedTask || !sself.operationTaskQueue) {
+            return;
+        }
+        
+        [sself.operationTaskQueue addTask:parkedTask nextEligibleTime:nextEligibleTime];
+        [sself startTasksInOperationQueueIfNeed];
+        
+    }];
+}
+
+- (void)removeParkedTaskWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    [self.retryTimerWheel cancelTimerWithIdentifier:transactionIdentifier];
+    [self.parkedTasks removeObjectForKey:transactionIdentifier];
+}
+
+- (void)removeAllParkedTasks {
+    [self.retryTimerWheel cancelAllTimers];
+    [self.parkedTasks removeAllObjects];
+}
+
+// 步长设定.
+// 每一笔交易的重试间隔都以上一次的间隔为基础, 按重试策略指数退避, 并且加上随机抖动.
+- (NSTimeInterval)nextRetryIntervalForTransactionIdentifier:(NSString *)transactionIdentifier {
+    NSTimeInterval previousInterval = self.retryIntervalsByTransactionIdentifier[transactionIdentifier].doubleValue;
+    NSTimeInterval interval = [self.retryPolicy retryIntervalWithPreviousInterval:previousInterval];
+    self.retryIntervalsByTransactionIdentifier[transactionIdentifier] = @(interval);
+    return interval;
+}
+
+- (BOOL)containsTaskWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    return [self.operationTaskQueue taskWithTransactionIdentifier:transactionIdentifier] || self.parkedTasks[transactionIdentifier] || [self isVerifingTransactionWithIdentifier:transactionIdentifier];
+}
+
+// 任务队列还没有加载过就从 keychain 加载, 返回是否需要等待加载完成.
+- (BOOL)loadOperationTaskQueueIfNeed {
+    if (self.operationTaskQueue) {
+        return NO;
+    }
+    
+    if (!self.isOperationTaskQueueLoading) {
+        [self internalStartPaymentTransactionVerifing];
+    }
+    return YES;
+}
+
+// 收据有变动. 只有还在等待的 task 换成新的收据.
+// 正在验证的 task 不打断, 用旧的收据完成这次请求, 旧的收据里同样有这笔交易. 失败重新排队的时候自然换成新的收据.
+- (void)resetOperationTaskQueueWithTransactionReceiptData {
+    [self.operationTaskQueue replaceTasksUsingBlock:^BLPaymentVerifyTask *(BLPaymentVerifyTask *task) {
+        
+        return [self taskWithTransactionModel:task.transactionModel];
+        
+    }];
+    for (NSString *transactionIdentifier in self.parkedTasks.allKeys) {
+        self.parkedTasks[transactionIdentifier] = [self taskWithTransactionModel:self.parkedTasks[transactionIdentifier].transactionModel];
+    }
+    
+    // 已经在用新收据的请求本来也不用重发, 只记还在用旧收据的请求.
+    [self recordSavedVerifyRequestsPassingTest:^BOOL(BLPaymentTransactionReceipt *transactionReceipt) {
+        
+        return transactionReceipt != self.transactionReceipt;
+        
+    }];
+}
+
+// 记录没有被打断的验证请求. 同一个请求在多次收据刷新和重新加载中只记一次, 批量验证按一个请求记.
+- (void)recordSavedVerifyRequestsPassingTest:(BOOL (NS_NOESCAPE ^)(BLPaymentTransactionReceipt *transactionReceipt))predicate {
+    NSHashTable<BLPaymentVerifyTask *> *batchedTasks = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    for (BLPaymentVerifyBatchTask *batchTask in self.verifingBatchTasks) {
+        for (BLPaymentVerifyTask *task in batchTask.tasks) {
+            [batchedTasks addObject:task];
+        }
+        if (![self verifingTaskCountInBatchTask:batchTask] || [self.savedVerifyRequests containsObject:batchTask] || !predicate(batchTask.transactionReceipt)) {
+            continue;
+        }
+        
+        [self.savedVerifyRequests addObject:batchTask];
+        self.savedVerifyRequestCountM++;
+    }
+    for (BLPaymentVerifyTask *task in self.verifingTasksM) {
+        if ([batchedTasks containsObject:task] || [self.savedVerifyRequests containsObject:task] || !predicate(task.transactionReceipt)) {
+            continue;
+        }
+        
+        [self.savedVerifyRequests addObject:task];
+        self.savedVerifyRequestCountM++;
+    }
 }
 
 - (void)internalAppendPaymentTransactionModel:(BLPaymentTransactionModel *)transactionModel {
-    // 首先持久化到 keychain.
-    [self.keychainStore bl_savePaymentTransactionModels:@[transactionModel] forUser:self.userid];
+    // 读取的是已经写入完成的快照, 调用方可能把还在排队写入的交易再添加一次. 已经有 task 的交易一定已经提交过, 不能用新的 model 覆盖.
+    if ([self containsTaskWithTransactionIdentifier:transactionModel.transactionIdentifier]) {
+        return;
+    }
+    
+    // 预创建的订单在交易完成时才绑定到交易上, 绑定的是当前版本的收据.
+    if (transactionModel.orderNo.length && !transactionModel.md5) {
+        transactionModel.md5 = self.transactionReceipt.md5;
+    }
+    
+    // 首先持久化到 keychain. 之后重置任务队列时读取 keychain 也在持久化队列上, 一定能读到这笔交易.
+    [self performStoreUpdates:^(BLWalletTransactionModelsBatch *batch) {
+        
+        [batch savePaymentTransactionModel:transactionModel];
+        
+    } completion:nil];
+    
+    // 任务队列还没有加载完成, 重新加载. 读取 keychain 排在上面的写入之后, 一定能读到这笔交易.
+    if (!self.operationTaskQueue) {
+        [self internalStartPaymentTransactionVerifing];
+        return;
+    }
     
-    // 如果有在执行的任务, 不打断当前的验证.
-    // 等待当前任务执行完就会将当前这个模型推入到验证队列.
-    if (self.currentVerifingTask) {
+    // 直接插入任务队列, 不打断正在进行的验证.
+    if (![self containsTaskWithTransactionIdentifier:transactionModel.transactionIdentifier]) {
+        [self enqueueTaskWithTransactionModel:transactionModel];
+    }
+    [self startTasksInOperationQueueIfNeed];
+}
+
+
+#pragma mark - Persistence
+
+// 修改 keychain, 在持久化队列上异步提交, 完成回调在验证队列执行.
+// 如果正在收集批量修改, 直接并入当前的批量修改, 由 `-commitStoreUpdates` 统一提交.
+- (void)performStoreUpdates:(BLPaymentVerifyStoreUpdates)updates completion:(nullable dispatch_block_t)completion {
+    NSAssert([self isOnManagerQueue], @"只能在验证队列进行当前操作");
+    if (self.pendingStoreUpdates) {
+        [self.pendingStoreUpdates addObject:updates];
+        if (completion) {
+            [self.pendingStoreCompletions addObject:completion];
+        }
         return;
     }
     
-    // 如果没有在执行的任务就直接开始当前验证.
-    [self cancelAllTaskAndResetAllModelsThenStartFirstTaskIfNeed];
+    [self beginStoreUpdates];
+    [self performStoreUpdates:updates completion:completion];
+    [self commitStoreUpdates];
+}
+
+- (void)beginStoreUpdates {
+    NSAssert([self isOnManagerQueue], @"只能在验证队列进行当前操作");
+    NSAssert(!self.pendingStoreUpdates, @"不支持嵌套的批量修改");
+    self.pendingStoreUpdates = [NSMutableArray array];
+    self.pendingStoreCompletions = [NSMutableArray array];
+}
+
+- (void)commitStoreUpdates {
+    NSAssert([self isOnManagerQueue], @"只能在验证队列进行当前操作");
+    NSArray<BLPaymentVerifyStoreUpdates> *updatesArray = self.pendingStoreUpdates.copy;
+    NSArray<dispatch_block_t> *completions = self.pendingStoreCompletions.copy;
+    self.pendingStoreUpdates = nil;
+    self.pendingStoreCompletions = nil;
+    if (!updatesArray.count) {
+        return;
+    }
+    
+    BLWalletKeyChainStore *keychainStore = self.keychainStore;
+    NSString *userid = self.userid;
+    dispatch_queue_t managerQueue = self.managerQueue;
+    dispatch_async(self.persistenceQueue, ^{
+        
+        [keychainStore bl_performBatchUpdatesForUser:userid usingBlock:^(BLWalletTransactionModelsBatch *batch) {
+            
+            for (BLPaymentVerifyStoreUpdates updates in updatesArray) {
+                updates(batch);
+            }
+            
+        }];
+        if (!completions.count) {
+            return;
+        }
+        dispatch_async(managerQueue, ^{
+            
+            for (dispatch_block_t completion in completions) {
+                completion();
+            }
+            
+        });
+        
+    });
+}
+
+// 直接读取 keychain store 发布的快照, 不经过验证队列和持久化队列, 在主线程读取不会等待正在进行的写入.
+// 只能读到已经写入完成的修改, 还在排队的修改要等 `-performAfterAllPendingPersistenceFinished:` 以后才能读到.
+- (void)readStoreUsingBlock:(void(NS_NOESCAPE ^)(BLWalletKeyChainStore *store))block {
+    block(self.keychainStore);
+}
+
+// 在持久化队列上提前加载当前用户的数据, 之后的读取都是无锁的快照.
+- (void)preloadKeychainStore {
+    BLWalletKeyChainStore *keychainStore = self.keychainStore;
+    NSString *userid = self.userid;
+    dispatch_async(self.persistenceQueue, ^{
+        
+        [keychainStore bl_fetchAllPaymentTransactionModelsForUser:userid error:nil];
+        
+    });
+}
+
+// 在持久化队列上异步读取 keychain, 结果回调在验证队列执行.
+- (void)fetchAllPaymentTransactionModelsWithCompletion:(void(^)(NSArray<BLPaymentTransactionModel *> * _Nullable models, NSError * _Nullable error))completion {
+    BLWalletKeyChainStore *keychainStore = self.keychainStore;
+    NSString *userid = self.userid;
+    dispatch_queue_t managerQueue = self.managerQueue;
+    dispatch_async(self.persistenceQueue, ^{
+        
+        NSError *error = nil;
+        NSArray<BLPaymentTransactionModel *> *models = [keychainStore bl_fetchAllPaymentTransactionModelsForUser:userid error:&error];
+        dispatch_async(managerQueue, ^{
+            
+            completion(models, error);
+            
+        });
+        
+    });
 }
 
 
 #pragma mark - Setup
 
 - (void)internalStartPaymentTransactionVerifing {
-    [self resetAllIfNeed];
-    
-    // 开始第一个任务.
-    [self startFirstTaskInOperationQueueIfNeed];
+    __weak typeof(self) wself = self;
+    [self resetAllIfNeedWithCompletion:^{
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        // 开始队列前面的任务, 直到并发名额用完.
+        [sself startTasksInOperationQueueIfNeed];
+        
+    }];
 }
 
-- (void)startFirstTaskInOperationQueueIfNeed {
+- (void)startTasksInOperationQueueIfNeed {
     if (!self.operationTaskQueue.count) {
         return;
     }
@@ -411,112 +1108,124 @@ NSString *const kBLPaymentVerifyManagerKeychainStoreServiceKey = @"com.ibeiliao.
         return;
     }
     
-    // 步长设定.
-    // 只要是已经和后台验证过并且失败过的交易, 两次请求之间的时间间隔是失败的次数 * BLPaymentVerifyUploadReceiptDataIntervalDelta.
-    __weak typeof(self) wself = self;
-    self.currentVerifingTask = self.operationTaskQueue.firstObject;
-    if (self.currentVerifingTask.transactionModel.modelVerifyCount > 0) { // 说明是重新验证.
-        NSTimeInterval intervalDelta = self.currentVerifingTask.transactionModel.modelVerifyCount * BLPaymentVerifyUploadReceiptDataIntervalDelta;
-        if (intervalDelta > BLPaymentVerifyUploadReceiptDataMaxIntervalDelta) {
-            intervalDelta = BLPaymentVerifyUploadReceiptDataMaxIntervalDelta;
-        }
-        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(intervalDelta * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-            
-            __strong typeof(wself) sself = wself;
-            if (!sself) return;
-            [self.currentVerifingTask start];
-            
-        });
-    }
-    else {
-        [self.currentVerifingTask start];
+    // 批量验证, 已经创建过订单的交易合并成一个请求, 收据只上传一次.
+    if (self.batchVerifyEnabled) {
+        [self startBatchVerifyTaskInOperationQueueIfNeed];
     }
     
-}
-
-- (void)resetAllIfNeed {
-    // 取消当前 task.
-    if (self.currentVerifingTask) {
-        [self.currentVerifingTask cancel];
+    // 每次取出优先级最高的 task, 直到并发名额用完. task 开始以后可能同步回调重新入队, 所以每次都重新取.
+    // 正在验证的交易不会留在队列里, 所以同一笔交易同一时间只能有一个 task 在验证, 保证同一笔交易的请求按顺序到达后台.
+    // 队列里只有现在就可以开始验证的 task, 还没到重试时间的 task 停放在时间轮上, 不会占用并发名额.
+    while (self.operationTaskQueue.count && self.verifingRequestCount < self.maxConcurrentVerifyTaskCount) {
+        BLPaymentVerifyTask *task = [self.operationTaskQueue popFirstTask];
+        NSAssert(![self isVerifingTransactionWithIdentifier:task.transactionModel.transactionIdentifier], @"致命错误 😢, 同一笔交易有两个 task 在验证");
+        [self startVerifingTask:task];
     }
-    
-    // 重置任务队列.
-    [self resetOperationTaskQueueIfNeed];
 }
 
-- (void)resetOperationTaskQueueIfNeed {
-    if (!self.transactionReceiptData.length) {
-        NSLog(@"收据为空, 先传收据进来, 再开始队列");
+- (void)startBatchVerifyTaskInOperationQueueIfNeed {
+    if (self.verifingRequestCount >= self.maxConcurrentVerifyTaskCount) {
         return;
     }
     
-    self.operationTaskQueue = nil;
+    // 队列里的 task 都已经到了可以验证的时间, 还在退避的 task 停放在时间轮上, 不参与批量验证.
+    NSArray<BLPaymentVerifyTask *> *candidateTasks = self.operationTaskQueue.allTasks;
     
-    NSError *error = nil;
-    // 所有还未得到验证的交易(持久化的).
-    NSArray<BLPaymentTransactionModel *> *transactionModels = [self.keychainStore bl_fetchAllPaymentTransactionModelsForUser:self.userid error:&error];
-    if (error) {
-        NSLog(@"%@", error);
+    // 只有一笔交易的时候, 批量请求没有意义.
+    if (candidateTasks.count < 2) {
         return;
     }
     
-    NSMutableArray<BLPaymentTransactionModel *> *transactionModelsM = [transactionModels mutableCopy];
-    // 剔除已经验证完成的交易.
-    NSMutableArray<BLPaymentTransactionModel *> *validTransactions = [NSMutableArray array];
-    for (BLPaymentTransactionModel *model in transactionModels) {
-        if (model.isTransactionValidFromService) {
-            [validTransactions addObject:model];
-        }
-    }
-    if (validTransactions.count) {
-        for (BLPaymentTransactionModel *model in validTransactions) {
-            [transactionModelsM removeObject:model];
-        }
-    }
-    if (!transactionModelsM.count) {
+    BLPaymentVerifyBatchTask *batchTask = [[BLPaymentVerifyBatchTask alloc] initWithTasks:candidateTasks transactionReceipt:self.transactionReceipt];
+    if (batchTask.tasks.count < 2) {
         return;
     }
     
-    // 动态规划当前应该验证哪一笔订单.
-    NSArray<BLPaymentTransactionModel *> *transactionModelsVerifyNow = [self dynamicPlanNeedVerifyModelsWithAllModels:transactionModelsM];
-    
-    NSParameterAssert(self.transactionReceiptData.length);
-    NSMutableArray<BLPaymentVerifyTask *> *tasksM = [NSMutableArray arrayWithCapacity:transactionModelsVerifyNow.count];
-    for (BLPaymentTransactionModel *model in transactionModelsVerifyNow) {
-        BLPaymentVerifyTask *task = [[BLPaymentVerifyTask alloc] initWithPaymentTransactionModel:model transactionReceiptData:self.transactionReceiptData];
-        task.delegate = self;
-        [tasksM addObject:task];
+    // 批量验证里的 task 同样占用 verifingTasksM, 代理回调的检查和单独验证的 task 一致.
+    for (BLPaymentVerifyTask *task in batchTask.tasks) {
+        [self.operationTaskQueue removeTaskWithTransactionIdentifier:task.transactionModel.transactionIdentifier];
     }
-    self.operationTaskQueue = tasksM;
+    [self.verifingBatchTasks addObject:batchTask];
+    [self.verifingTasksM addObjectsFromArray:batchTask.tasks];
+    [self publishVerifingTasks];
+    [batchTask start];
 }
 
-// 动态规划当前应该验证哪一笔订单.
-- (NSArray<BLPaymentTransactionModel *> *)dynamicPlanNeedVerifyModelsWithAllModels:(NSArray<BLPaymentTransactionModel *> *) allTransationModels {
-    // 防止出现: 第一个失败的订单一直在验证, 排队的订单得不到验证.
-    NSMutableArray<BLPaymentTransactionModel *> *transactionModelsNeverVerify = [NSMutableArray array];
-    NSMutableArray<BLPaymentTransactionModel *> *transactionModelsRetry = [NSMutableArray array];
-    for (BLPaymentTransactionModel *model in allTransationModels) {
-        if (model.modelVerifyCount == 0) {
-            [transactionModelsNeverVerify addObject:model];
-        }
-        else {
-            [transactionModelsRetry addObject:model];
-        }
-    }
+- (void)startVerifingTask:(BLPaymentVerifyTask *)task {
+    // 占用一个并发名额, 直到收到这个 task 的回调.
+    [self.verifingTasksM addObject:task];
+    [self publishVerifingTasks];
+    [task start];
+}
+
+- (void)resetAllIfNeedWithCompletion:(nullable dispatch_block_t)completion {
+    // 正在验证的 task 不打断, 重新加载的任务队列会跳过这些交易, 等它们自己的回调.
+    // 网络来回切换或者收据刷新的时候, 不会丢掉已经发出去的请求再重新发一次.
+    [self recordSavedVerifyRequestsPassingTest:^BOOL(BLPaymentTransactionReceipt *transactionReceipt) {
+        
+        return YES;
+        
+    }];
     
-    // 从未验证过的订单, 优先验证.
-    if (transactionModelsNeverVerify.count) {
-        return transactionModelsNeverVerify.copy;
+    // 重置任务队列.
+    [self resetOperationTaskQueueIfNeedWithCompletion:completion];
+}
+
+// 重置任务队列. 读取 keychain 在持久化队列上异步进行, 完成回调只在本次重置没有被更新的重置覆盖时执行.
+- (void)resetOperationTaskQueueIfNeedWithCompletion:(nullable dispatch_block_t)completion {
+    if (!self.transactionReceipt) {
+        NSLog(@"收据为空, 先传收据进来, 再开始队列");
+        return;
     }
     
-    // 验证次数少的排前面.
-    [transactionModelsRetry sortUsingComparator:^NSComparisonResult(BLPaymentTransactionModel * obj1, BLPaymentTransactionModel * obj2) {
-       
-        return obj1.modelVerifyCount > obj2.modelVerifyCount ? NSOrderedAscending : NSOrderedDescending;
+    self.operationTaskQueue = nil;
+    [self removeAllParkedTasks];
+    self.operationTaskQueueLoading = YES;
+    self.finishedTransactionIdentifiersWhileLoading = [NSMutableSet set];
+    NSUInteger generation = ++self.operationTaskQueueGeneration;
+    
+    // 所有还未得到验证的交易(持久化的).
+    __weak typeof(self) wself = self;
+    [self fetchAllPaymentTransactionModelsWithCompletion:^(NSArray<BLPaymentTransactionModel *> *transactionModels, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        if (generation != sself.operationTaskQueueGeneration) {
+            return;
+        }
+        sself.operationTaskQueueLoading = NO;
+        NSSet<NSString *> *finishedTransactionIdentifiers = sself.finishedTransactionIdentifiersWhileLoading.copy;
+        sself.finishedTransactionIdentifiersWhileLoading = nil;
+        // 没有持久化的交易时 store 也会返回错误, 这时用空的任务队列, 之后新加入的交易照常入队.
+        if (error) {
+            NSLog(@"%@", error);
+        }
+        
+        [sself resetOperationTaskQueueWithTransactionModels:transactionModels ?: @[] finishedTransactionIdentifiers:finishedTransactionIdentifiers];
+        if (completion) {
+            completion();
+        }
         
     }];
-    
-    return transactionModelsRetry.copy;
+}
+
+- (void)resetOperationTaskQueueWithTransactionModels:(NSArray<BLPaymentTransactionModel *> *)transactionModels
+                      finishedTransactionIdentifiers:(NSSet<NSString *> *)finishedTransactionIdentifiers {
+    // 由优先队列决定当前应该验证哪一笔订单.
+    self.operationTaskQueue = [BLPaymentVerifyTaskScheduler new];
+    for (BLPaymentTransactionModel *model in transactionModels) {
+        // 剔除已经验证完成的交易. 只读取头部字段, 不会触发交易模型的完整解码.
+        if (model.isTransactionValidFromService) {
+            continue;
+        }
+        
+        // 剔除加载期间已经有结果的交易, 和还在验证或者等待重试的交易, 只加入新的需要验证的交易.
+        if ([finishedTransactionIdentifiers containsObject:model.transactionIdentifier] || [self containsTaskWithTransactionIdentifier:model.transactionIdentifier]) {
+            continue;
+        }
+        
+        [self enqueueTaskWithTransactionModel:model];
+    }
 }
 
 @end
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 验证失败以后的重试策略: 带去相关抖动(decorrelated jitter)的指数退避.
+ *
+ * 下一次的重试间隔在 [baseInterval, 上一次间隔 * 3] 之间随机, 并且不超过 maxInterval.
+ * 后台从故障中恢复的时候, 各个客户端的重试时间是分散的, 不会同时涌向后台.
+ */
+@interface BLPaymentVerifyRetryPolicy : NSObject<NSCopying>
+
+/**
+ * 最小重试间隔, 单位为秒, 默认为 BLPaymentVerifyUploadReceiptDataIntervalDelta.
+ */
+@property(nonatomic, assign) NSTimeInterval baseInterval;
+
+/**
+ * 最大重试间隔, 单位为秒, 默认为 BLPaymentVerifyUploadReceiptDataMaxIntervalDelta.
+ */
+@property(nonatomic, assign) NSTimeInterval maxInterval;
+
+/**
+ * 最多验证次数, 超过以后本次启动不再重试, 等下次启动重新加载. 默认为 0, 表示不限制.
+ *
+ * 创建订单失败和上传收据失败都计入验证次数.
+ */
+@property(nonatomic, assign) NSUInteger maxAttemptCount;
+
+/**
+ * 默认策略.
+ */
++ (instancetype)defaultPolicy;
+
+/**
+ * 计算下一次的重试间隔.
+ *
+ * @param previousInterval 上一次的重试间隔, 没有重试过传 0.
+ *
+ * @return 下一次的重试间隔.
+ */
+- (NSTimeInterval)retryIntervalWithPreviousInterval:(NSTimeInterval)previousInterval;
+
+/**
+ * 已经验证了 attemptCount 次以后, 是否还可以继续重试.
+ */
+- (BOOL)shouldRetryAfterAttemptCount:(NSUInteger)attemptCount;
+
+@end
+
+NS_ASSUME_NONNULL_END
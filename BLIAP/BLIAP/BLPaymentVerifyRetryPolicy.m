@@ -0,0 +1,63 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyRetryPolicy.h"
+#import "BLWalletCompat.h"
+
+@implementation BLPaymentVerifyRetryPolicy
+
++ (instancetype)defaultPolicy {
+    return [self new];
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _baseInterval = BLPaymentVerifyUploadReceiptDataIntervalDelta;
+        _maxInterval = BLPaymentVerifyUploadReceiptDataMaxIntervalDelta;
+        _maxAttemptCount = 0;
+    }
+    return self;
+}
+
+- (NSTimeInterval)retryIntervalWithPreviousInterval:(NSTimeInterval)previousInterval {
+    NSTimeInterval baseInterval = MAX(self.baseInterval, 0);
+    NSTimeInterval maxInterval = MAX(self.maxInterval, baseInterval);
+    NSTimeInterval upperInterval = MAX(previousInterval, baseInterval) * 3;
+    double random = (double)arc4random() / UINT32_MAX;
+    NSTimeInterval interval = baseInterval + (upperInterval - baseInterval) * random;
+    return MIN(interval, maxInterval);
+}
+
+- (BOOL)shouldRetryAfterAttemptCount:(NSUInteger)attemptCount {
+    if (!self.maxAttemptCount) {
+        return YES;
+    }
+    
+    return attemptCount < self.maxAttemptCount;
+}
+
+
+#pragma mark - NSCopying
+
+- (id)copyWithZone:(NSZone *)zone {
+    BLPaymentVerifyRetryPolicy *policy = [[[self class] allocWithZone:zone] init];
+    policy.baseInterval = self.baseInterval;
+    policy.maxInterval = self.maxInterval;
+    policy.maxAttemptCount = self.maxAttemptCount;
+    return policy;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"baseInterval: %@, maxInterval: %@, maxAttemptCount: %@", @(self.baseInterval), @(self.maxInterval), @(self.maxAttemptCount)];
+}
+
+@end
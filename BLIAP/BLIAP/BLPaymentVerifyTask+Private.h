@@ -0,0 +1,30 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyTask.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * BLPaymentVerifyTask 内部的状态.
+ *
+ * 只给 BLPaymentVerifyTask 和 BLPaymentVerifyBatchTask 使用, 批量验证的结果通过公开的结果处理方法分发给每一个 task.
+ */
+@interface BLPaymentVerifyTask()
+
+/**
+ * task 状态.
+ */
+@property(nonatomic, assign) BLPaymentVerifyTaskState taskState;
+
+@end
+
+NS_ASSUME_NONNULL_END
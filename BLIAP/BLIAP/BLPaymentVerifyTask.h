@@ -11,7 +11,7 @@
 
 #import <UIKit/UIKit.h>
 
-@class BLPaymentTransactionModel;
+@class BLPaymentTransactionModel, BLPaymentTransactionReceipt;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -46,14 +46,16 @@ typedef NS_ENUM(NSUInteger, BLPaymentVerifyTaskState) { // task 状态.
 /**
  * 创建订单请求成功.
  *
+ * @warning 代理只需要持久化订单, task 会接着上传收据验证, 验证结果通过其他代理方法回调.
+ *
  * @param task           当前任务.
  * @param orderNo        订单号.
- * @param priceTagString 价格字符串.
+ * @param priceTagString 价格字符串, 后台没有返回时为空.
  * @param md5            交易收据是否有变动的标识.
  */
 - (void)paymentVerifyTaskDidReceiveCreateOrderResponse:(BLPaymentVerifyTask *)task
                                                orderNo:(NSString *)orderNo
-                                        priceTagString:(NSString *)priceTagString
+                                        priceTagString:(nullable NSString *)priceTagString
                                                    md5:(NSString *)md5;
 
 /**
@@ -84,7 +86,14 @@ typedef NS_ENUM(NSUInteger, BLPaymentVerifyTaskState) { // task 状态.
 /**
  * 收据.
  */
-@property(nonatomic, strong, readonly) NSData *transactionReceiptData;
+@property(nonatomic, strong, readonly) BLPaymentTransactionReceipt *transactionReceipt;
+
+/**
+ * 请求结果和代理回调所在的队列, 为空时在主线程.
+ *
+ * @warning task 的状态只在这个队列上修改, 必须和调用 -start、-cancel 的是同一个串行队列.
+ */
+@property(nonatomic, strong, nullable) dispatch_queue_t completionQueue;
 
 /**
  * 初始化方法.
@@ -92,11 +101,11 @@ typedef NS_ENUM(NSUInteger, BLPaymentVerifyTaskState) { // task 状态.
  * @warning 交易模型不能为空.
  *
  * @param paymentTransactionModel 交易模型.
- * @param transactionReceiptData  交易凭证.
+ * @param transactionReceipt      交易凭证, 同一个版本的收据所有 task 共享同一个实例.
  *
  * @return 当前实例.
  */
-- (instancetype)initWithPaymentTransactionModel:(BLPaymentTransactionModel *)paymentTransactionModel transactionReceiptData:(NSData *)transactionReceiptData NS_DESIGNATED_INITIALIZER;
+- (instancetype)initWithPaymentTransactionModel:(BLPaymentTransactionModel *)paymentTransactionModel transactionReceipt:(BLPaymentTransactionReceipt *)transactionReceipt NS_DESIGNATED_INITIALIZER;
 
 /**
  * 开始执行当前 task.
@@ -112,6 +121,68 @@ typedef NS_ENUM(NSUInteger, BLPaymentVerifyTaskState) { // task 状态.
  */
 - (void)cancel;
 
+
+#pragma mark - Request
+
+// 和自己的后台通讯.
+// 默认实现按示例接口(见 `BLWalletCompat.h` 里的接口路径)和示例数据格式请求 `BLPaymentVerifyTransport`.
+// 接入时在这里(或者子类)换成自己后台的请求和解析, 再把请求结果转为下面的结果处理方法, 驱动整个验证流程.
+
+/**
+ * 发送创建订单请求.
+ *
+ * 示例数据格式: 成功时返回 {"orderNo": "", "priceTagString": "", "md5": ""}.
+ *
+ * @param productIdentifier 商品标识.
+ * @param md5               当前收据的 md5 值.
+ */
+- (void)sendCreateOrderRequestWithProductIdentifier:(NSString *)productIdentifier md5:(NSString *)md5;
+
+/**
+ * 发送上传收据验证请求.
+ *
+ * 示例数据格式: {"status": 1, "message": ""}, status 的取值见 `BLPaymentVerifyBatchResult`.
+ */
+- (void)sendUploadCertificateRequest;
+
+
+#pragma mark - Request Result Handle
+
+// 请求结果处理, 必须在 `completionQueue` 上调用.
+
+/**
+ * 验证收据有效.
+ */
+- (void)handleVerifingTransactionValid;
+
+/**
+ * 验证收据无效.
+ *
+ * @param errorMsg 后台返回的错误信息.
+ */
+- (void)handleVerifingTransactionInvalidWithErrorMessage:(NSString *)errorMsg;
+
+/**
+ * 上传收据验证请求失败, 需要重新验证.
+ */
+- (void)handleUploadCertificateRequestFailed;
+
+/**
+ * 创建订单成功, task 会接着上传收据验证.
+ *
+ * @param orderNo        订单号.
+ * @param priceTagString 价格字符串, 后台没有返回时为空.
+ * @param md5            交易收据是否有变动的标识.
+ */
+- (void)handleCreateOrderSuccessedWithOrderNo:(NSString *)orderNo
+                               priceTagString:(nullable NSString *)priceTagString
+                                          md5:(NSString *)md5;
+
+/**
+ * 创建订单请求失败, 需要重新验证.
+ */
+- (void)handleCreateOrderFailed;
+
 @end
 
 NS_ASSUME_NONNULL_END
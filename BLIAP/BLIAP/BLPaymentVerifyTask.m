@@ -10,9 +10,16 @@
  */
 
 #import "BLPaymentVerifyTask.h"
+#import "BLPaymentVerifyTask+Private.h"
 #import "BLPaymentTransactionModel.h"
+#import "BLPaymentTransactionReceipt.h"
+#import "BLPaymentVerifyTransport.h"
 #import "BLWalletCompat.h"
-#import <NSData+MD5Digest.h>
+
+// 创建订单请求超时时间, 单位为秒.
+static NSTimeInterval const kBLPaymentVerifyTaskCreateOrderTimeoutInterval = 15;
+// 上传收据验证请求超时时间, 单位为秒. 收据比较大, 而且后台要等苹果服务器的验证结果.
+static NSTimeInterval const kBLPaymentVerifyTaskUploadCertificateTimeoutInterval = 30;
 
 @interface BLPaymentVerifyTask()<UIAlertViewDelegate>
 
@@ -22,14 +29,14 @@
 @property(nonatomic, strong, nonnull) BLPaymentTransactionModel *transactionModel;
 
 /**
- * task 状态.
+ * 收据.
  */
-@property(nonatomic, assign) BLPaymentVerifyTaskState taskState;
+@property(nonatomic, strong, nonnull) BLPaymentTransactionReceipt *transactionReceipt;
 
 /**
- * 收据.
+ * 正在进行的请求.
  */
-@property(nonatomic, strong, nonnull) NSData *transactionReceiptData;
+@property(nonatomic, strong, nullable) NSURLSessionDataTask *dataTask;
 
 @end
 
@@ -37,13 +44,13 @@
 
 - (instancetype)init {
     NSAssert(NO, @"使用指定的初始化接口来初始化当前类");
-    return [self initWithPaymentTransactionModel:[BLPaymentTransactionModel new] transactionReceiptData:[NSData new]];
+    return [self initWithPaymentTransactionModel:[BLPaymentTransactionModel new] transactionReceipt:[[BLPaymentTransactionReceipt alloc] initWithData:[NSData new]]];
 }
 
-- (instancetype)initWithPaymentTransactionModel:(BLPaymentTransactionModel *)paymentTransactionModel transactionReceiptData:(nonnull NSData *)transactionReceiptData {
+- (instancetype)initWithPaymentTransactionModel:(BLPaymentTransactionModel *)paymentTransactionModel transactionReceipt:(nonnull BLPaymentTransactionReceipt *)transactionReceipt {
     NSParameterAssert(paymentTransactionModel);
-    NSParameterAssert(transactionReceiptData);
-    if (!paymentTransactionModel || !transactionReceiptData.length) {
+    NSParameterAssert(transactionReceipt);
+    if (!paymentTransactionModel || !transactionReceipt) {
         return nil;
     }
     
@@ -51,7 +58,7 @@
     if (self) {
         _transactionModel = paymentTransactionModel;
         _taskState = BLPaymentVerifyTaskStateDefault;
-        _transactionReceiptData = transactionReceiptData;
+        _transactionReceipt = transactionReceipt;
     }
     return self;
 }
@@ -62,14 +69,9 @@
         return;
     }
     
-    NSString *receipts = [self.transactionReceiptData base64EncodedStringWithOptions:NSDataBase64EncodingEndLineWithLineFeed];
-    if (!receipts.length) {
-        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"验证收据为空 crtf: %@", receipts]}];
-        // [BLAssert reportError:error];
-    }
-    
     // 如果有订单号和 md5 值, 并且 md5 值没有变动, 开始验证.
-    NSString *md5 = [NSData MD5HexDigest:[receipts dataUsingEncoding:NSUTF8StringEncoding]];
+    // base64 编码和 md5 值在收据创建时已经计算好了, 这里不再重复计算.
+    NSString *md5 = self.transactionReceipt.md5;
     BOOL needStartVerify = self.transactionModel.orderNo.length && self.transactionModel.md5 && [self.transactionModel.md5 isEqualToString:md5];
     self.taskState = BLPaymentVerifyTaskStateWaitingForServersResponse;
     if (needStartVerify) {
@@ -85,7 +87,9 @@
 - (void)cancel {
     self.taskState = BLPaymentVerifyTaskStateCancel;
     
-    // 执行取消请求.
+    // 执行取消请求, 马上断开连接, 不再占用带宽.
+    [self.dataTask cancel];
+    self.dataTask = nil;
 }
 
 
@@ -93,12 +97,81 @@
 
 - (void)sendCreateOrderRequestWithProductIdentifier:(NSString *)productIdentifier md5:(NSString *)md5 {
     // 执行创建订单请求.
+    NSDictionary *parameters = @{
+                                 @"productIdentifier" : productIdentifier ?: @"",
+                                 @"transactionIdentifier" : self.transactionModel.transactionIdentifier ?: @"",
+                                 @"md5" : md5 ?: @""
+                                 };
+    __weak typeof(self) wself = self;
+    self.dataTask = [BLPaymentVerifyTransport.sharedTransport POST:BLPaymentVerifyCreateOrderPath parameters:parameters timeoutInterval:kBLPaymentVerifyTaskCreateOrderTimeoutInterval completionQueue:self.completionQueue completion:^(NSDictionary *data, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        sself.dataTask = nil;
+        // 调用 -cancel 取消的请求直接忽略. 其他原因取消的请求按请求失败处理, 等待重新验证.
+        if (sself.taskState == BLPaymentVerifyTaskStateCancel) {
+            return;
+        }
+        
+        NSString *orderNo = [data[@"orderNo"] isKindOfClass:[NSString class]] ? data[@"orderNo"] : nil;
+        if (error || !orderNo.length) {
+            [sself reportErrorWithErrorString:[NSString stringWithFormat:@"创建订单失败: %@, transactionIdentifier: %@", error.localizedDescription, sself.transactionModel.transactionIdentifier]];
+            [sself handleCreateOrderFailed];
+            return;
+        }
+        
+        NSString *priceTagString = [data[@"priceTagString"] isKindOfClass:[NSString class]] ? data[@"priceTagString"] : nil;
+        NSString *responseMd5 = [data[@"md5"] isKindOfClass:[NSString class]] ? data[@"md5"] : md5;
+        [sself handleCreateOrderSuccessedWithOrderNo:orderNo priceTagString:priceTagString md5:responseMd5];
+        
+    }];
 }
 
 - (void)sendUploadCertificateRequest {
     // 发送上传凭证进行验证请求.
-    NSString *receipts = [self.transactionReceiptData base64EncodedStringWithOptions:NSDataBase64EncodingEndLineWithLineFeed];
-    NSString *md5 = [NSData MD5HexDigest:[receipts dataUsingEncoding:NSUTF8StringEncoding]];
+    NSString *receipts = self.transactionReceipt.base64EncodedString;
+    NSString *md5 = self.transactionReceipt.md5;
+    NSDictionary *parameters = @{
+                                 @"orderNo" : self.transactionModel.orderNo ?: @"",
+                                 @"transactionIdentifier" : self.transactionModel.transactionIdentifier ?: @"",
+                                 @"receipt" : receipts ?: @"",
+                                 @"md5" : md5 ?: @""
+                                 };
+    __weak typeof(self) wself = self;
+    self.dataTask = [BLPaymentVerifyTransport.sharedTransport POST:BLPaymentVerifyUploadCertificatePath parameters:parameters timeoutInterval:kBLPaymentVerifyTaskUploadCertificateTimeoutInterval completionQueue:self.completionQueue completion:^(NSDictionary *data, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        sself.dataTask = nil;
+        // 调用 -cancel 取消的请求直接忽略. 其他原因取消的请求按请求失败处理, 等待重新验证.
+        if (sself.taskState == BLPaymentVerifyTaskStateCancel) {
+            return;
+        }
+        
+        if (error) {
+            [sself handleUploadCertificateRequestFailed];
+            return;
+        }
+        
+        // 验证结果和批量验证一致: 1 收据有效, 2 收据无效, 其他需要重新验证.
+        NSUInteger status = [data[@"status"] respondsToSelector:@selector(unsignedIntegerValue)] ? [data[@"status"] unsignedIntegerValue] : 0;
+        NSString *message = [data[@"message"] isKindOfClass:[NSString class]] ? data[@"message"] : @"订单验证失败";
+        sself.taskState = BLPaymentVerifyTaskStateFinished;
+        switch (status) {
+            case 1:
+                [sself handleVerifingTransactionValid];
+                break;
+            
+            case 2:
+                [sself handleVerifingTransactionInvalidWithErrorMessage:message];
+                break;
+            
+            default:
+                [sself handleUploadCertificateRequestFailed];
+                break;
+        }
+        
+    }];
 }
 
 
@@ -119,8 +192,12 @@
         [self.delegate paymentVerifyTaskDidReceiveResponseReceiptInvalid:self];
     }
     
-    UIAlertView *alert = [[UIAlertView alloc] initWithTitle:errorMsg message:nil delegate:nil cancelButtonTitle:@"OK" otherButtonTitles:nil];
-    [alert show];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        
+        UIAlertView *alert = [[UIAlertView alloc] initWithTitle:errorMsg message:nil delegate:nil cancelButtonTitle:@"OK" otherButtonTitles:nil];
+        [alert show];
+        
+    });
 }
 
 - (void)handleUploadCertificateRequestFailed {
@@ -132,17 +209,41 @@
 }
 
 - (void)handleCreateOrderSuccessedWithOrderNo:(NSString *)orderNo
-                               priceTagString:(NSString *)priceTagString
+                               priceTagString:(nullable NSString *)priceTagString
                                           md5:(NSString *)md5 {
     NSLog(@"创建订单成功");
+    if (self.taskState == BLPaymentVerifyTaskStateCancel) {
+        return;
+    }
+    
+    // 订单号记到当前 task 上, 之后重新验证的 task 直接上传收据, 不用再创建订单.
+    BLPaymentTransactionModel *transactionModel = [self.transactionModel copy];
+    transactionModel.orderNo = orderNo;
+    if (priceTagString) {
+        transactionModel.priceTagString = priceTagString;
+    }
+    transactionModel.md5 = md5;
+    self.transactionModel = transactionModel;
+    
+    // 通知代理持久化订单.
     [self sendNotificationWithName:BLPaymentVerifyTaskCreateOrderDidSuccessedNotification];
     if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyTaskDidReceiveCreateOrderResponse:orderNo:priceTagString:md5:)]) {
         [self.delegate paymentVerifyTaskDidReceiveCreateOrderResponse:self orderNo:orderNo priceTagString:priceTagString md5:md5];
     }
+    
+    // 代理可能在回调里取消了当前 task.
+    if (self.taskState == BLPaymentVerifyTaskStateCancel) {
+        return;
+    }
+    
+    // 不用重新排队, 同一个 task 接着上传收据验证.
+    NSLog(@"创建订单成功, 接着上传收据验证");
+    [self sendUploadCertificateRequest];
 }
 
 - (void)handleCreateOrderFailed {
     NSLog(@"创建订单失败");
+    self.taskState = BLPaymentVerifyTaskStateFinished;
     [self sendNotificationWithName:BLPaymentVerifyTaskCreateOrderRequestFailedNotification];
     if (self.delegate && [self.delegate respondsToSelector:@selector(paymentVerifyTaskCreateOrderRequestFailed:)]) {
         [self.delegate paymentVerifyTaskCreateOrderRequestFailed:self];
@@ -198,8 +299,13 @@
     return isTransactionIdentifierMatch && isProductIdentifierMatch;
 }
 
+// 通知的接收方可能会刷新 UI, 统一在主线程发出.
 - (void)sendNotificationWithName:(NSString *)noteName {
-    [[NSNotificationCenter defaultCenter] postNotificationName:noteName object:self];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        
+        [[NSNotificationCenter defaultCenter] postNotificationName:noteName object:self];
+        
+    });
 }
 
 @end
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class BLPaymentVerifyTask;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 待验证 task 的优先队列(二叉堆), 入队, 出队和移除都是 O(log n).
+ *
+ * 优先级依次比较:
+ * 1. 从未验证过的交易永远排在重新验证的交易前面.
+ * 2. 可以开始验证的时间早的排前面.
+ * 3. 验证次数少的排前面.
+ * 4. 先进入队列的排前面, 同一笔交易重新入队时保留第一次入队的顺序.
+ *
+ * 重新验证的交易每失败一次, 可以开始验证的时间都会往后推, 等待越久的交易越靠前, 不会有交易一直得不到验证.
+ *
+ * @warning 同一笔交易在队列中最多只有一个 task. 不是线程安全的.
+ */
+@interface BLPaymentVerifyTaskScheduler : NSObject
+
+/**
+ * 队列中 task 的数量.
+ */
+@property(nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ * 队列中所有的 task, 不保证顺序.
+ */
+@property(nonatomic, copy, readonly) NSArray<BLPaymentVerifyTask *> *allTasks;
+
+/**
+ * 入队, 已经有同一笔交易的 task 时替换掉原来的 task.
+ *
+ * @param task             task.
+ * @param nextEligibleTime 可以开始验证的时间, 以 `NSProcessInfo.systemUptime` 为基准.
+ */
+- (void)addTask:(BLPaymentVerifyTask *)task nextEligibleTime:(NSTimeInterval)nextEligibleTime;
+
+/**
+ * 取出优先级最高的 task.
+ */
+- (nullable BLPaymentVerifyTask *)popFirstTask;
+
+/**
+ * 查找指定交易的 task.
+ */
+- (nullable BLPaymentVerifyTask *)taskWithTransactionIdentifier:(NSString *)transactionIdentifier;
+
+/**
+ * 移除指定交易的 task, 不存在时返回 nil.
+ */
+- (nullable BLPaymentVerifyTask *)removeTaskWithTransactionIdentifier:(NSString *)transactionIdentifier;
+
+/**
+ * 替换队列中的每一个 task, 不改变优先级.
+ *
+ * @param block 返回替换以后的 task, 必须是同一笔交易.
+ */
+- (void)replaceTasksUsingBlock:(BLPaymentVerifyTask *(NS_NOESCAPE ^)(BLPaymentVerifyTask *task))block;
+
+/**
+ * 交易已经有了验证结果, 不会再入队, 丢弃这笔交易第一次入队的顺序.
+ */
+- (void)forgetTransactionWithIdentifier:(NSString *)transactionIdentifier;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,258 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyTaskScheduler.h"
+#import "BLPaymentVerifyTask.h"
+#import "BLPaymentTransactionModel.h"
+
+@interface BLPaymentVerifySchedulerEntry : NSObject
+
+@property(nonatomic, strong) BLPaymentVerifyTask *task;
+
+@property(nonatomic, assign) NSTimeInterval nextEligibleTime;
+
+@property(nonatomic, assign) NSUInteger modelVerifyCount;
+
+@property(nonatomic, assign) uint64_t sequence;
+
+/**
+ * 在堆中的位置, 用来在 O(log n) 内移除.
+ */
+@property(nonatomic, assign) NSUInteger heapIndex;
+
+@end
+
+@implementation BLPaymentVerifySchedulerEntry
+
+@end
+
+// entry1 是否比 entry2 优先.
+static BOOL BLPaymentVerifySchedulerEntryHasHigherPriority(BLPaymentVerifySchedulerEntry *entry1, BLPaymentVerifySchedulerEntry *entry2) {
+    BOOL isFresh1 = entry1.modelVerifyCount == 0;
+    BOOL isFresh2 = entry2.modelVerifyCount == 0;
+    if (isFresh1 != isFresh2) {
+        return isFresh1;
+    }
+    
+    if (entry1.nextEligibleTime != entry2.nextEligibleTime) {
+        return entry1.nextEligibleTime < entry2.nextEligibleTime;
+    }
+    
+    if (entry1.modelVerifyCount != entry2.modelVerifyCount) {
+        return entry1.modelVerifyCount < entry2.modelVerifyCount;
+    }
+    
+    return entry1.sequence < entry2.sequence;
+}
+
+@interface BLPaymentVerifyTaskScheduler()
+
+/**
+ * 二叉堆, 下标 0 是优先级最高的 entry.
+ */
+@property(nonatomic, strong, nonnull) NSMutableArray<BLPaymentVerifySchedulerEntry *> *heap;
+
+/**
+ * 交易标识 -> entry.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, BLPaymentVerifySchedulerEntry *> *entriesByTransactionIdentifier;
+
+/**
+ * 交易标识 -> 第一次入队的顺序.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, NSNumber *> *sequencesByTransactionIdentifier;
+
+/**
+ * 下一个入队顺序.
+ */
+@property(nonatomic, assign) uint64_t nextSequence;
+
+@end
+
+@implementation BLPaymentVerifyTaskScheduler
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _heap = [NSMutableArray array];
+        _entriesByTransactionIdentifier = [NSMutableDictionary dictionary];
+        _sequencesByTransactionIdentifier = [NSMutableDictionary dictionary];
+        _nextSequence = 0;
+    }
+    return self;
+}
+
+
+#pragma mark - Public
+
+- (NSUInteger)count {
+    return self.heap.count;
+}
+
+- (NSArray<BLPaymentVerifyTask *> *)allTasks {
+    NSMutableArray<BLPaymentVerifyTask *> *tasksM = [NSMutableArray arrayWithCapacity:self.heap.count];
+    for (BLPaymentVerifySchedulerEntry *entry in self.heap) {
+        [tasksM addObject:entry.task];
+    }
+    return tasksM.copy;
+}
+
+- (void)addTask:(BLPaymentVerifyTask *)task nextEligibleTime:(NSTimeInterval)nextEligibleTime {
+    NSParameterAssert(task);
+    if (!task) {
+        return;
+    }
+    
+    NSString *transactionIdentifier = task.transactionModel.transactionIdentifier;
+    [self removeTaskWithTransactionIdentifier:transactionIdentifier];
+    
+    NSNumber *sequence = self.sequencesByTransactionIdentifier[transactionIdentifier];
+    if (!sequence) {
+        sequence = @(self.nextSequence++);
+        self.sequencesByTransactionIdentifier[transactionIdentifier] = sequence;
+    }
+    
+    BLPaymentVerifySchedulerEntry *entry = [BLPaymentVerifySchedulerEntry new];
+    entry.task = task;
+    entry.nextEligibleTime = nextEligibleTime;
+    entry.modelVerifyCount = task.transactionModel.modelVerifyCount;
+    entry.sequence = sequence.unsignedLongLongValue;
+    entry.heapIndex = self.heap.count;
+    [self.heap addObject:entry];
+    self.entriesByTransactionIdentifier[transactionIdentifier] = entry;
+    [self internalSiftUpFromIndex:entry.heapIndex];
+}
+
+- (BLPaymentVerifyTask *)popFirstTask {
+    BLPaymentVerifySchedulerEntry *entry = self.heap.firstObject;
+    if (!entry) {
+        return nil;
+    }
+    
+    [self internalRemoveEntry:entry];
+    return entry.task;
+}
+
+- (BLPaymentVerifyTask *)taskWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier.length) {
+        return nil;
+    }
+    
+    return self.entriesByTransactionIdentifier[transactionIdentifier].task;
+}
+
+- (BLPaymentVerifyTask *)removeTaskWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier.length) {
+        return nil;
+    }
+    
+    BLPaymentVerifySchedulerEntry *entry = self.entriesByTransactionIdentifier[transactionIdentifier];
+    if (!entry) {
+        return nil;
+    }
+    
+    [self internalRemoveEntry:entry];
+    return entry.task;
+}
+
+- (void)replaceTasksUsingBlock:(BLPaymentVerifyTask *(NS_NOESCAPE ^)(BLPaymentVerifyTask *task))block {
+    NSParameterAssert(block);
+    if (!block) {
+        return;
+    }
+    
+    for (BLPaymentVerifySchedulerEntry *entry in self.heap) {
+        BLPaymentVerifyTask *task = block(entry.task);
+        NSParameterAssert([task.transactionModel.transactionIdentifier isEqualToString:entry.task.transactionModel.transactionIdentifier]);
+        if (task) {
+            entry.task = task;
+        }
+    }
+}
+
+- (void)forgetTransactionWithIdentifier:(NSString *)transactionIdentifier {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier.length) {
+        return;
+    }
+    
+    if (self.entriesByTransactionIdentifier[transactionIdentifier]) {
+        return;
+    }
+    
+    [self.sequencesByTransactionIdentifier removeObjectForKey:transactionIdentifier];
+}
+
+
+#pragma mark - Private
+
+- (void)internalRemoveEntry:(BLPaymentVerifySchedulerEntry *)entry {
+    NSUInteger index = entry.heapIndex;
+    NSUInteger lastIndex = self.heap.count - 1;
+    [self.entriesByTransactionIdentifier removeObjectForKey:entry.task.transactionModel.transactionIdentifier];
+    if (index != lastIndex) {
+        [self internalSwapIndex:index withIndex:lastIndex];
+    }
+    [self.heap removeLastObject];
+    if (index >= self.heap.count) {
+        return;
+    }
+    
+    // 换上来的 entry 可能需要上浮, 也可能需要下沉.
+    BLPaymentVerifySchedulerEntry *movedEntry = self.heap[index];
+    [self internalSiftUpFromIndex:index];
+    if (movedEntry.heapIndex == index) {
+        [self internalSiftDownFromIndex:index];
+    }
+}
+
+- (void)internalSiftUpFromIndex:(NSUInteger)index {
+    while (index > 0) {
+        NSUInteger parentIndex = (index - 1) / 2;
+        if (!BLPaymentVerifySchedulerEntryHasHigherPriority(self.heap[index], self.heap[parentIndex])) {
+            break;
+        }
+        
+        [self internalSwapIndex:index withIndex:parentIndex];
+        index = parentIndex;
+    }
+}
+
+- (void)internalSiftDownFromIndex:(NSUInteger)index {
+    NSUInteger count = self.heap.count;
+    while (index < count) {
+        NSUInteger leftIndex = index * 2 + 1;
+        NSUInteger rightIndex = leftIndex + 1;
+        NSUInteger highestIndex = index;
+        if (leftIndex < count && BLPaymentVerifySchedulerEntryHasHigherPriority(self.heap[leftIndex], self.heap[highestIndex])) {
+            highestIndex = leftIndex;
+        }
+        if (rightIndex < count && BLPaymentVerifySchedulerEntryHasHigherPriority(self.heap[rightIndex], self.heap[highestIndex])) {
+            highestIndex = rightIndex;
+        }
+        if (highestIndex == index) {
+            break;
+        }
+        
+        [self internalSwapIndex:index withIndex:highestIndex];
+        index = highestIndex;
+    }
+}
+
+- (void)internalSwapIndex:(NSUInteger)index1 withIndex:(NSUInteger)index2 {
+    [self.heap exchangeObjectAtIndex:index1 withObjectAtIndex:index2];
+    self.heap[index1].heapIndex = index1;
+    self.heap[index2].heapIndex = index2;
+}
+
+@end
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 哈希时间轮.
+ *
+ * 所有定时器共用一个 dispatch 定时器, 每个 tick 转动一格, 只处理当前格子里的定时器, 添加和取消都是 O(1).
+ * 同一个 tick 里到期的定时器在同一次唤醒里一起执行, 没有定时器的时候停止转动.
+ *
+ * @warning 所有方法都必须在初始化时传入的队列上调用.
+ */
+@interface BLPaymentVerifyTimerWheel : NSObject
+
+/**
+ * 等待执行的定时器数量.
+ */
+@property(nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ * 初始化方法.
+ *
+ * @param tickInterval 每一格的时间, 也是定时器的精度, 单位为秒.
+ * @param slotCount    格子数量.
+ * @param queue        定时器执行的队列, 必须是串行队列.
+ *
+ * @return 当前实例.
+ */
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval slotCount:(NSUInteger)slotCount queue:(dispatch_queue_t)queue NS_DESIGNATED_INITIALIZER;
+
+/**
+ * 添加定时器, 已经有相同标识的定时器时替换掉原来的定时器.
+ *
+ * @param identifier 定时器标识.
+ * @param interval   多久以后执行, 精度为一个 tick.
+ * @param handler    到期执行的 block.
+ */
+- (void)scheduleTimerWithIdentifier:(NSString *)identifier afterInterval:(NSTimeInterval)interval handler:(dispatch_block_t)handler;
+
+/**
+ * 取消定时器.
+ */
+- (void)cancelTimerWithIdentifier:(NSString *)identifier;
+
+/**
+ * 取消所有定时器.
+ */
+- (void)cancelAllTimers;
+
+@end
+
+NS_ASSUME_NONNULL_END
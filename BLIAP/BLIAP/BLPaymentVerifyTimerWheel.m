@@ -0,0 +1,208 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyTimerWheel.h"
+
+@interface BLPaymentVerifyTimerWheelEntry : NSObject
+
+@property(nonatomic, copy) NSString *identifier;
+
+@property(nonatomic, copy) dispatch_block_t handler;
+
+/**
+ * 所在的格子.
+ */
+@property(nonatomic, assign) NSUInteger slotIndex;
+
+/**
+ * 还需要转过几圈才到期.
+ */
+@property(nonatomic, assign) NSUInteger remainingRounds;
+
+@end
+
+@implementation BLPaymentVerifyTimerWheelEntry
+
+@end
+
+@interface BLPaymentVerifyTimerWheel()
+
+@property(nonatomic, assign) NSTimeInterval tickInterval;
+
+@property(nonatomic, strong, nonnull) dispatch_queue_t queue;
+
+/**
+ * 格子, 每个格子里是 定时器标识 -> entry.
+ */
+@property(nonatomic, strong, nonnull) NSArray<NSMutableDictionary<NSString *, BLPaymentVerifyTimerWheelEntry *> *> *slots;
+
+/**
+ * 定时器标识 -> entry.
+ */
+@property(nonatomic, strong, nonnull) NSMutableDictionary<NSString *, BLPaymentVerifyTimerWheelEntry *> *entriesByIdentifier;
+
+/**
+ * 当前指向的格子.
+ */
+@property(nonatomic, assign) NSUInteger currentSlotIndex;
+
+/**
+ * 驱动时间轮转动的定时器, 没有等待执行的定时器时为 nil.
+ */
+@property(nonatomic, strong, nullable) dispatch_source_t tickTimer;
+
+@end
+
+@implementation BLPaymentVerifyTimerWheel
+
+- (void)dealloc {
+    if (_tickTimer) {
+        dispatch_source_cancel(_tickTimer);
+    }
+}
+
+- (instancetype)init {
+    NSAssert(NO, @"使用指定的初始化接口来初始化当前类");
+    return [self initWithTickInterval:1 slotCount:64 queue:dispatch_get_main_queue()];
+}
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval slotCount:(NSUInteger)slotCount queue:(dispatch_queue_t)queue {
+    NSParameterAssert(tickInterval > 0);
+    NSParameterAssert(slotCount > 0);
+    NSParameterAssert(queue);
+    if (tickInterval <= 0 || !slotCount || !queue) {
+        return nil;
+    }
+    
+    self = [super init];
+    if (self) {
+        _tickInterval = tickInterval;
+        _queue = queue;
+        NSMutableArray<NSMutableDictionary<NSString *, BLPaymentVerifyTimerWheelEntry *> *> *slots = [NSMutableArray arrayWithCapacity:slotCount];
+        for (NSUInteger i = 0; i < slotCount; i++) {
+            [slots addObject:[NSMutableDictionary dictionary]];
+        }
+        _slots = slots.copy;
+        _entriesByIdentifier = [NSMutableDictionary dictionary];
+        _currentSlotIndex = 0;
+    }
+    return self;
+}
+
+
+#pragma mark - Public
+
+- (NSUInteger)count {
+    return self.entriesByIdentifier.count;
+}
+
+- (void)scheduleTimerWithIdentifier:(NSString *)identifier afterInterval:(NSTimeInterval)interval handler:(dispatch_block_t)handler {
+    NSParameterAssert(identifier);
+    NSParameterAssert(handler);
+    if (!identifier.length || !handler) {
+        return;
+    }
+    
+    [self cancelTimerWithIdentifier:identifier];
+    
+    // 至少转动一格才执行, 保证不会在当前调用栈里执行.
+    NSUInteger ticks = (NSUInteger)MAX(ceil(interval / self.tickInterval), 1);
+    NSUInteger slotCount = self.slots.count;
+    BLPaymentVerifyTimerWheelEntry *entry = [BLPaymentVerifyTimerWheelEntry new];
+    entry.identifier = identifier;
+    entry.handler = handler;
+    entry.slotIndex = (self.currentSlotIndex + ticks) % slotCount;
+    entry.remainingRounds = (ticks - 1) / slotCount;
+    self.slots[entry.slotIndex][identifier] = entry;
+    self.entriesByIdentifier[identifier] = entry;
+    [self internalStartTickTimerIfNeed];
+}
+
+- (void)cancelTimerWithIdentifier:(NSString *)identifier {
+    NSParameterAssert(identifier);
+    if (!identifier.length) {
+        return;
+    }
+    
+    BLPaymentVerifyTimerWheelEntry *entry = self.entriesByIdentifier[identifier];
+    if (!entry) {
+        return;
+    }
+    
+    [self.slots[entry.slotIndex] removeObjectForKey:identifier];
+    [self.entriesByIdentifier removeObjectForKey:identifier];
+    [self internalStopTickTimerIfNeed];
+}
+
+- (void)cancelAllTimers {
+    for (NSMutableDictionary<NSString *, BLPaymentVerifyTimerWheelEntry *> *slot in self.slots) {
+        [slot removeAllObjects];
+    }
+    [self.entriesByIdentifier removeAllObjects];
+    [self internalStopTickTimerIfNeed];
+}
+
+
+#pragma mark - Private
+
+- (void)internalStartTickTimerIfNeed {
+    if (self.tickTimer) {
+        return;
+    }
+    
+    // 允许 10% 的误差, 让系统可以合并唤醒.
+    uint64_t interval = (uint64_t)(self.tickInterval * NSEC_PER_SEC);
+    dispatch_source_t tickTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.queue);
+    dispatch_source_set_timer(tickTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    __weak typeof(self) wself = self;
+    dispatch_source_set_event_handler(tickTimer, ^{
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        [sself internalTick];
+        
+    });
+    self.tickTimer = tickTimer;
+    dispatch_resume(tickTimer);
+}
+
+- (void)internalStopTickTimerIfNeed {
+    if (!self.tickTimer || self.entriesByIdentifier.count) {
+        return;
+    }
+    
+    dispatch_source_cancel(self.tickTimer);
+    self.tickTimer = nil;
+}
+
+- (void)internalTick {
+    self.currentSlotIndex = (self.currentSlotIndex + 1) % self.slots.count;
+    NSMutableDictionary<NSString *, BLPaymentVerifyTimerWheelEntry *> *slot = self.slots[self.currentSlotIndex];
+    NSMutableArray<dispatch_block_t> *handlers = [NSMutableArray array];
+    for (BLPaymentVerifyTimerWheelEntry *entry in slot.allValues) {
+        if (entry.remainingRounds > 0) {
+            entry.remainingRounds--;
+            continue;
+        }
+        
+        [slot removeObjectForKey:entry.identifier];
+        [self.entriesByIdentifier removeObjectForKey:entry.identifier];
+        [handlers addObject:entry.handler];
+    }
+    
+    // 先更新状态再执行, handler 里可以添加或者取消定时器.
+    [self internalStopTickTimerIfNeed];
+    for (dispatch_block_t handler in handlers) {
+        handler();
+    }
+}
+
+@end
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 请求结束的回调, 在发起请求时指定的队列执行.
+ *
+ * @param data  后台返回的数据, 请求失败时为空.
+ * @param error 错误信息, 包括网络错误和后台返回的错误.
+ */
+typedef void(^BLPaymentVerifyTransportCompletion)(NSDictionary * _Nullable data, NSError * _Nullable error);
+
+/**
+ * 和验证后台通讯的传输层.
+ *
+ * 所有请求共用同一个 session, 复用已经建立的连接, TLS 会话也由同一个 session 复用.
+ * 用户发起购买的时候可以先预热连接, 交易完成以后的请求就不用再等 DNS、TCP 和 TLS 握手.
+ */
+@interface BLPaymentVerifyTransport : NSObject
+
+/**
+ * 单例.
+ */
+@property(class, nonatomic, strong, readonly) BLPaymentVerifyTransport *sharedTransport;
+
+/**
+ * 验证后台地址, 接入时设置成自己的后台地址, 比如 https://api.example.com/v1/.
+ *
+ * 请求路径始终拼接在这个地址的路径后面, 地址里的路径前缀不会丢失. 没有设置时所有请求直接失败.
+ *
+ * @warning 在发起任何请求之前设置.
+ */
+@property(nonatomic, copy, nullable) NSURL *baseURL;
+
+/**
+ * 预热连接的次数(累计).
+ *
+ * @warning 统计数据可以在任意线程读取. 复用情况依赖 iOS 10 的请求指标, 低版本系统一直为 0.
+ */
+@property(atomic, assign, readonly) NSUInteger prewarmCount;
+
+/**
+ * 预热以后, 直接复用了热连接的请求数量(累计).
+ */
+@property(atomic, assign, readonly) NSUInteger reusedConnectionCount;
+
+/**
+ * 复用热连接节省的握手时间(累计), 单位为秒.
+ *
+ * 每次预热的握手时间只计算一次, 记在预热以后第一个复用连接的请求上.
+ */
+@property(atomic, assign, readonly) NSTimeInterval savedHandshakeDuration;
+
+/**
+ * 单例方法.
+ */
++ (instancetype)sharedTransport;
+
+/**
+ * 初始化方法.
+ *
+ * @param baseURL 验证后台地址, 可以之后再设置.
+ *
+ * @return 当前实例.
+ */
+- (instancetype)initWithBaseURL:(nullable NSURL *)baseURL NS_DESIGNATED_INITIALIZER;
+
+/**
+ * 发送 POST 请求, 参数使用 JSON 编码.
+ *
+ * 后台返回的数据格式为 {"code": 0, "msg": "", "data": {}}, code 不为 0 时按请求失败处理.
+ *
+ * @warning 取消的请求也会回调, error 为 NSURLErrorDomain 的 NSURLErrorCancelled, 调用方自己决定是否忽略.
+ *
+ * @param path            请求路径, 拼接在 `baseURL` 的路径后面.
+ * @param parameters      请求参数.
+ * @param timeoutInterval 超时时间, 单位为秒.
+ * @param completionQueue 回调所在的队列, 为空时在主线程回调. 调用方的状态只在自己的串行队列上修改时, 传入这个队列.
+ * @param completion      请求结束的回调.
+ *
+ * @return 请求, 调用 -cancel 马上断开请求, 不再占用带宽.
+ */
+- (nullable NSURLSessionDataTask *)POST:(NSString *)path
+                             parameters:(NSDictionary *)parameters
+                        timeoutInterval:(NSTimeInterval)timeoutInterval
+                        completionQueue:(nullable dispatch_queue_t)completionQueue
+                             completion:(BLPaymentVerifyTransportCompletion)completion;
+
+/**
+ * 预热到验证后台的连接.
+ *
+ * @warning 正在预热或者刚刚预热过的时候不会重复预热, 可以多次调用. 请求的是 `BLPaymentVerifyPrewarmPath` 接口, 没有设置 `baseURL` 时不预热.
+ */
+- (void)prewarmConnectionIfNeed;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,299 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyTransport.h"
+#import "BLWalletCompat.h"
+#import <AFHTTPSessionManager.h>
+
+// NSURLSessionTaskMetrics 从 iOS 10 开始才有, 低版本系统不收集请求指标.
+typedef void(^BLPaymentVerifySessionTaskMetricsBlock)(NSURLSessionTask *task, NSURLSessionTaskMetrics *metrics) NS_AVAILABLE_IOS(10_0);
+
+/**
+ * AFNetworking 3.1.0 没有转发收集到的请求指标, 这里补上.
+ */
+@interface BLPaymentVerifySessionManager : AFHTTPSessionManager
+
+/**
+ * 收集到请求指标的回调, 在 session 的代理队列执行.
+ */
+@property(nonatomic, copy, nullable) BLPaymentVerifySessionTaskMetricsBlock taskDidFinishCollectingMetrics NS_AVAILABLE_IOS(10_0);
+
+@end
+
+@implementation BLPaymentVerifySessionManager
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics NS_AVAILABLE_IOS(10_0) {
+    if (self.taskDidFinishCollectingMetrics) {
+        self.taskDidFinishCollectingMetrics(task, metrics);
+    }
+}
+
+@end
+
+// 预热请求的标识.
+static NSString *const kBLPaymentVerifyTransportPrewarmTaskDescription = @"com.ibeiliao.payment.verify.transport.prewarm.www";
+// 预热间隔, 单位为秒. 这段时间内连接还是热的, 不需要重复预热.
+static NSTimeInterval const kBLPaymentVerifyTransportPrewarmInterval = 30;
+
+@interface BLPaymentVerifyTransport()
+
+/**
+ * 所有请求共用的 session.
+ */
+@property(nonatomic, strong, nonnull) BLPaymentVerifySessionManager *sessionManager;
+
+/**
+ * 预热连接的次数, 只在主线程修改.
+ */
+@property(atomic, assign) NSUInteger prewarmCount;
+
+/**
+ * 复用了热连接的请求数量, 只在 session 的代理队列修改.
+ */
+@property(atomic, assign) NSUInteger reusedConnectionCount;
+
+/**
+ * 节省的握手时间, 只在 session 的代理队列修改.
+ */
+@property(atomic, assign) NSTimeInterval savedHandshakeDuration;
+
+/**
+ * 最近一次预热的时间(系统启动时间), 0 表示还没有预热过. 只在主线程读写.
+ */
+@property(nonatomic, assign) NSTimeInterval lastPrewarmTime;
+
+/**
+ * 最近一次预热付出的握手时间, 还没有被后面的请求复用. 只在 session 的代理队列读写.
+ */
+@property(nonatomic, assign) NSTimeInterval pendingPrewarmHandshakeDuration;
+
+@end
+
+@implementation BLPaymentVerifyTransport
+
+static BLPaymentVerifyTransport *_sharedTransport = nil;
++ (instancetype)sharedTransport {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // 验证后台地址由接入方设置.
+        _sharedTransport = [[BLPaymentVerifyTransport alloc] initWithBaseURL:nil];
+    });
+    
+    return _sharedTransport;
+}
+
+- (instancetype)init {
+    return [self initWithBaseURL:nil];
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)baseURL {
+    self = [super init];
+    if (self) {
+        _baseURL = [baseURL copy];
+        
+        // 同一个 session 里的请求复用连接(keep-alive, 后台支持时使用 HTTP/2 多路复用), TLS 会话也会被复用, 不用每次都完整握手.
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+        configuration.HTTPMaximumConnectionsPerHost = 4;
+        configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        // 请求地址由 `-URLForPath:` 拼接, session 不需要 baseURL.
+        _sessionManager = [[BLPaymentVerifySessionManager alloc] initWithBaseURL:nil sessionConfiguration:configuration];
+        _sessionManager.requestSerializer = [AFJSONRequestSerializer serializer];
+        _sessionManager.responseSerializer = [AFJSONResponseSerializer serializer];
+        
+        // 响应在自己的队列上解析, 不占用主线程, 再切到调用方指定的队列回调.
+        _sessionManager.completionQueue = dispatch_queue_create("com.ibeiliao.payment.verify.transport.completion.queue", DISPATCH_QUEUE_SERIAL);
+        
+        // 请求指标只在 iOS 10 以上收集, 低版本系统不统计复用情况, 预热照常进行.
+        if (@available(iOS 10.0, *)) {
+            __weak typeof(self) wself = self;
+            [_sessionManager setTaskDidFinishCollectingMetrics:^(NSURLSessionTask *task, NSURLSessionTaskMetrics *metrics) {
+                
+                // AFNetworking 的代理队列是串行的, 统计数据直接在这里更新, 不占用主线程.
+                __strong typeof(wself) sself = wself;
+                if (!sself) return;
+                BOOL isPrewarmTask = [task.taskDescription isEqualToString:kBLPaymentVerifyTransportPrewarmTaskDescription];
+                NSURLSessionTaskTransactionMetrics *transactionMetrics = metrics.transactionMetrics.lastObject;
+                BOOL isReusedConnection = transactionMetrics.isReusedConnection;
+                NSTimeInterval handshakeDuration = [sself handshakeDurationWithTransactionMetrics:transactionMetrics];
+                [sself handleMetricsForPrewarmTask:isPrewarmTask isReusedConnection:isReusedConnection handshakeDuration:handshakeDuration];
+                
+            }];
+        }
+    }
+    return self;
+}
+
+
+#pragma mark - Public
+
+- (NSURLSessionDataTask *)POST:(NSString *)path
+                    parameters:(NSDictionary *)parameters
+               timeoutInterval:(NSTimeInterval)timeoutInterval
+               completionQueue:(dispatch_queue_t)completionQueue
+                    completion:(BLPaymentVerifyTransportCompletion)completion {
+    NSParameterAssert(path);
+    NSParameterAssert(completion);
+    if (!path || !completion) {
+        return nil;
+    }
+    
+    dispatch_queue_t callbackQueue = completionQueue ?: dispatch_get_main_queue();
+    BLPaymentVerifyTransportCompletion callback = ^(NSDictionary *data, NSError *error) {
+        
+        dispatch_async(callbackQueue, ^{
+            
+            completion(data, error);
+            
+        });
+        
+    };
+    
+    NSURL *URL = [self URLForPath:path];
+    if (!URL) {
+        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"验证后台地址没有设置或者请求路径无效, baseURL: %@, path: %@", self.baseURL, path]}];
+        callback(nil, error);
+        return nil;
+    }
+    
+    NSString *URLString = URL.absoluteString;
+    NSError *serializationError = nil;
+    NSMutableURLRequest *request = [self.sessionManager.requestSerializer requestWithMethod:@"POST" URLString:URLString parameters:parameters error:&serializationError];
+    if (serializationError) {
+        NSLog(@"请求参数编码失败: %@", serializationError);
+        callback(nil, serializationError);
+        return nil;
+    }
+    
+    // 每个请求有自己的超时时间, 不用等 session 默认的 60 秒.
+    request.timeoutInterval = timeoutInterval;
+    __weak typeof(self) wself = self;
+    NSURLSessionDataTask *dataTask = [self.sessionManager dataTaskWithRequest:request completionHandler:^(NSURLResponse *response, id responseObject, NSError *error) {
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        // 取消的请求也回调, error 为 NSURLErrorCancelled, 由调用方决定是否忽略.
+        if (error) {
+            callback(nil, error);
+            return;
+        }
+        
+        [sself handleResponseObject:responseObject completion:callback];
+        
+    }];
+    [dataTask resume];
+    return dataTask;
+}
+
+- (void)prewarmConnectionIfNeed {
+    NSAssert([NSThread isMainThread], @"不能再子线程进行当前操作");
+    NSURL *URL = [self URLForPath:BLPaymentVerifyPrewarmPath];
+    if (!URL) {
+        return;
+    }
+    
+    NSTimeInterval now = NSProcessInfo.processInfo.systemUptime;
+    if (self.lastPrewarmTime > 0 && now - self.lastPrewarmTime < kBLPaymentVerifyTransportPrewarmInterval) {
+        return;
+    }
+    
+    // 只需要建立连接, 不关心响应结果. 请求后台专门的轻量接口, HEAD 请求没有响应体.
+    self.lastPrewarmTime = now;
+    self.prewarmCount++;
+    NSURLSessionDataTask *task = [self.sessionManager HEAD:URL.absoluteString parameters:nil success:nil failure:^(NSURLSessionDataTask *dataTask, NSError *error) {
+        
+        NSLog(@"预热连接的请求失败, 不影响连接复用: %@", error);
+        
+    }];
+    task.taskDescription = kBLPaymentVerifyTransportPrewarmTaskDescription;
+    NSLog(@"开始预热验证后台的连接");
+}
+
+
+#pragma mark - URL
+
+// 路径拼接在 baseURL 的路径后面. 直接用 `+URLWithString:relativeToURL:` 的话, 以 `/` 开头的路径会丢掉 baseURL 里的路径前缀.
+- (NSURL *)URLForPath:(NSString *)path {
+    NSString *baseURLString = self.baseURL.absoluteString;
+    if (!baseURLString.length) {
+        return nil;
+    }
+    
+    if (![baseURLString hasSuffix:@"/"]) {
+        baseURLString = [baseURLString stringByAppendingString:@"/"];
+    }
+    while ([path hasPrefix:@"/"]) {
+        path = [path substringFromIndex:1];
+    }
+    return [NSURL URLWithString:path relativeToURL:[NSURL URLWithString:baseURLString]].absoluteURL;
+}
+
+
+#pragma mark - Response
+
+- (void)handleResponseObject:(id)responseObject completion:(BLPaymentVerifyTransportCompletion)completion {
+    if (![responseObject isKindOfClass:[NSDictionary class]]) {
+        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"验证后台返回的数据格式错误"}];
+        completion(nil, error);
+        return;
+    }
+    
+    NSDictionary *response = responseObject;
+    NSInteger code = [response[@"code"] respondsToSelector:@selector(integerValue)] ? [response[@"code"] integerValue] : -1;
+    if (code != 0) {
+        NSString *message = [response[@"msg"] isKindOfClass:[NSString class]] ? response[@"msg"] : @"验证后台返回错误";
+        NSError *error = [NSError errorWithDomain:BLWalletErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey : message}];
+        completion(nil, error);
+        return;
+    }
+    
+    NSDictionary *data = [response[@"data"] isKindOfClass:[NSDictionary class]] ? response[@"data"] : @{};
+    completion(data, nil);
+}
+
+
+#pragma mark - Metrics
+
+// DNS、TCP 和 TLS 握手的时间, 复用的连接没有握手.
+- (NSTimeInterval)handshakeDurationWithTransactionMetrics:(NSURLSessionTaskTransactionMetrics *)transactionMetrics NS_AVAILABLE_IOS(10_0) {
+    if (!transactionMetrics || transactionMetrics.isReusedConnection) {
+        return 0;
+    }
+    
+    NSDate *startDate = transactionMetrics.domainLookupStartDate ?: transactionMetrics.connectStartDate;
+    NSDate *endDate = transactionMetrics.connectEndDate;
+    if (!startDate || !endDate) {
+        return 0;
+    }
+    return MAX([endDate timeIntervalSinceDate:startDate], 0);
+}
+
+// 在 session 的代理队列执行.
+- (void)handleMetricsForPrewarmTask:(BOOL)isPrewarmTask isReusedConnection:(BOOL)isReusedConnection handshakeDuration:(NSTimeInterval)handshakeDuration {
+    // 预热请求付出的握手时间, 等后面第一个复用连接的请求来记账.
+    if (isPrewarmTask) {
+        if (handshakeDuration > 0) {
+            self.pendingPrewarmHandshakeDuration = handshakeDuration;
+        }
+        NSLog(@"预热连接完成, 握手时间: %.0fms", handshakeDuration * 1000);
+        return;
+    }
+    
+    if (!isReusedConnection || self.pendingPrewarmHandshakeDuration <= 0) {
+        return;
+    }
+    
+    self.reusedConnectionCount++;
+    self.savedHandshakeDuration += self.pendingPrewarmHandshakeDuration;
+    NSLog(@"验证请求复用了预热的连接, 节省握手时间: %.0fms, 累计节省: %.0fms", self.pendingPrewarmHandshakeDuration * 1000, self.savedHandshakeDuration * 1000);
+    self.pendingPrewarmHandshakeDuration = 0;
+}
+
+@end
@@ -38,11 +38,23 @@ UIKIT_EXTERN NSString *const BLPaymentManagerPaymentFailedNotification;
 // 交易验证成功, 弹出充值成功提醒, 用户点选 OK.
 UIKIT_EXTERN NSString *const BLPaymentUserDidClickOKAfterAlertNotification;
 
-// 验证已经验证过的交易时, 请求间隔步长因子, 单位为秒.
+// 验证已经验证过的交易时, 请求间隔步长因子, 单位为秒. 也是默认重试策略的最小重试间隔.
 UIKIT_EXTERN NSTimeInterval const BLPaymentVerifyUploadReceiptDataIntervalDelta;
-// 验证已经验证过的交易时, 请求间隔最大值, 单位为秒.
+// 验证已经验证过的交易时, 请求间隔最大值, 单位为秒. 也是默认重试策略的最大重试间隔.
 UIKIT_EXTERN NSTimeInterval const BLPaymentVerifyUploadReceiptDataMaxIntervalDelta;
 
+// 预创建订单的有效期, 单位为秒. 超过有效期还没有绑定交易的订单直接丢弃.
+UIKIT_EXTERN NSTimeInterval const BLPaymentSpeculativeOrderTimeToLive;
+
+// 创建订单的接口路径, 相对于验证后台地址(`BLPaymentVerifyTransport` 的 baseURL). 示例接口, 接入时替换成自己后台的接口.
+UIKIT_EXTERN NSString *const BLPaymentVerifyCreateOrderPath;
+// 上传收据验证的接口路径, 相对于验证后台地址. 示例接口, 接入时替换成自己后台的接口.
+UIKIT_EXTERN NSString *const BLPaymentVerifyUploadCertificatePath;
+// 批量上传收据验证的接口路径, 相对于验证后台地址. 示例接口, 接入时替换成自己后台的接口.
+UIKIT_EXTERN NSString *const BLPaymentVerifyBatchUploadCertificatePath;
+// 预热连接使用的轻量接口路径, 相对于验证后台地址. 只需要响应 HEAD 请求, 不做业务处理. 示例接口, 接入时替换成自己后台的接口.
+UIKIT_EXTERN NSString *const BLPaymentVerifyPrewarmPath;
+
 // 测试使用清空所有未完成的交易.
 UIKIT_EXTERN NSString *const BLClearAllUnfinishedTransiactionNotification;
 
@@ -28,5 +28,17 @@ NSTimeInterval const BLPaymentVerifyUploadReceiptDataIntervalDelta = 10;
 // 验证已经验证过的交易时, 请求间隔最大值, 单位为秒.
 NSTimeInterval const BLPaymentVerifyUploadReceiptDataMaxIntervalDelta = 60;
 
+// 预创建订单的有效期, 单位为秒.
+NSTimeInterval const BLPaymentSpeculativeOrderTimeToLive = 30 * 60;
+
+// 创建订单的接口路径, 接入时替换成自己后台的接口.
+NSString *const BLPaymentVerifyCreateOrderPath = @"payment/iap/order/create";
+// 上传收据验证的接口路径, 接入时替换成自己后台的接口.
+NSString *const BLPaymentVerifyUploadCertificatePath = @"payment/iap/receipt/verify";
+// 批量上传收据验证的接口路径, 接入时替换成自己后台的接口.
+NSString *const BLPaymentVerifyBatchUploadCertificatePath = @"payment/iap/receipt/batch_verify";
+// 预热连接使用的轻量接口路径, 接入时替换成自己后台的接口.
+NSString *const BLPaymentVerifyPrewarmPath = @"payment/iap/ping";
+
 // 测试使用清空所有未完成的交易.
 NSString *const BLClearAllUnfinishedTransiactionNotification = @"com.ibeiliao.payment.clear.all.unfinished.transication.note.www";
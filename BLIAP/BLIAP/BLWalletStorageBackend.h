@@ -0,0 +1,95 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+#import <UICKeyChainStore/UICKeyChainStore.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 交易模型存储的存储介质, 以 key - data 的形式读写.
+ *
+ * @warning 实现必须是线程安全的.
+ */
+@protocol BLWalletStorageBackend<NSObject>
+
+@required
+
+/**
+ * 读取数据.
+ *
+ * @param key key.
+ *
+ * @return 数据, 不存在时返回 nil.
+ */
+- (nullable NSData *)dataForKey:(NSString *)key;
+
+/**
+ * 写入数据, 已存在的 key 直接覆盖.
+ *
+ * @param data 数据.
+ * @param key  key.
+ *
+ * @return 是否写入成功.
+ */
+- (BOOL)setData:(NSData *)data forKey:(NSString *)key;
+
+/**
+ * 删除数据.
+ *
+ * @param key key.
+ *
+ * @return 是否删除成功, key 不存在时也返回 YES.
+ */
+- (BOOL)removeItemForKey:(NSString *)key;
+
+@end
+
+/**
+ * keychain 存储.
+ */
+@interface BLWalletKeyChainStorageBackend : UICKeyChainStore<BLWalletStorageBackend>
+
++ (BLWalletKeyChainStorageBackend *)keyChainStoreWithService:(NSString *_Nullable)service;
+
+@end
+
+/**
+ * 文件存储, 每个 key 一个文件.
+ *
+ * 读取时使用内存映射(mmap), 并且缓存最近映射的数据(有数量上限), 重复读取只会命中页缓存. 写入时原子替换文件并且丢弃这个 key 的缓存, 写入以后的读取一定来自磁盘, 已经映射的旧数据不受影响.
+ */
+@interface BLWalletFileStorageBackend : NSObject<BLWalletStorageBackend>
+
+/**
+ * 存储目录.
+ */
+@property(nonatomic, copy, readonly) NSURL *directoryURL;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 初始化方法.
+ *
+ * @param directoryURL 存储目录, 不存在时会自动创建.
+ */
+- (instancetype)initWithDirectoryURL:(NSURL *)directoryURL NS_DESIGNATED_INITIALIZER;
+
+@end
+
+/**
+ * 内存存储, 进程退出以后数据丢失.
+ */
+@interface BLWalletMemoryStorageBackend : NSObject<BLWalletStorageBackend>
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,202 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLWalletStorageBackend.h"
+#import <pthread.h>
+
+static const NSUInteger kBLWalletFileStorageMappedDataCacheCountLimit = 64;
+
+@implementation BLWalletKeyChainStorageBackend
+
++ (BLWalletKeyChainStorageBackend *)keyChainStoreWithService:(NSString *)service {
+    return (BLWalletKeyChainStorageBackend *)[super keyChainStoreWithService:service];
+}
+
+@end
+
+@interface BLWalletFileStorageBackend()
+
+@property (nonatomic) pthread_mutex_t lock;
+
+/**
+ * 已经映射到内存的数据, 以 key 为 key. 最多缓存 kBLWalletFileStorageMappedDataCacheCountLimit 个文件, 被淘汰的数据解除映射.
+ *
+ * @warning 只能在持有 lock 的情况下访问.
+ */
+@property (nonatomic, strong) NSCache<NSString *, NSData *> *mappedDataCache;
+
+@end
+
+@implementation BLWalletFileStorageBackend
+
+- (instancetype)init {
+    NSAssert(NO, @"请使用指定的方法初始化");
+    return [self initWithDirectoryURL:[NSURL fileURLWithPath:NSTemporaryDirectory()]];
+}
+
+- (instancetype)initWithDirectoryURL:(NSURL *)directoryURL {
+    NSParameterAssert(directoryURL.isFileURL);
+    self = [super init];
+    if (self) {
+        _directoryURL = [directoryURL copy];
+        _mappedDataCache = [NSCache new];
+        _mappedDataCache.countLimit = kBLWalletFileStorageMappedDataCacheCountLimit;
+        pthread_mutex_init(&(_lock), NULL);
+        
+        NSError *error = nil;
+        if (![[NSFileManager defaultManager] createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:&error]) {
+            NSLog(@"%@", [NSString stringWithFormat:@"创建存储目录失败: %@, %@", directoryURL, error]);
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSData *)dataForKey:(NSString *)key {
+    NSParameterAssert(key);
+    if (!key) {
+        return nil;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    NSData *data = [self.mappedDataCache objectForKey:key];
+    if (!data) {
+        // 文件不存在时直接返回 nil.
+        data = [NSData dataWithContentsOfURL:[self internalFileURLForKey:key] options:NSDataReadingMappedAlways error:nil];
+        if (data) {
+            [self.mappedDataCache setObject:data forKey:key];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return data;
+}
+
+- (BOOL)setData:(NSData *)data forKey:(NSString *)key {
+    NSParameterAssert(data);
+    NSParameterAssert(key);
+    if (!data || !key) {
+        return NO;
+    }
+    
+    NSError *error = nil;
+    pthread_mutex_lock(&_lock);
+    // 原子写入: 先写临时文件再替换, 写入中途失败不会破坏原来的数据.
+    BOOL success = [data writeToURL:[self internalFileURLForKey:key] options:NSDataWritingAtomic | NSDataWritingFileProtectionCompleteUntilFirstUserAuthentication error:&error];
+    // 不缓存写入的数据, 下一次读取从文件重新映射, 写入以后的回读确认读到的是磁盘上的数据.
+    [self.mappedDataCache removeObjectForKey:key];
+    pthread_mutex_unlock(&_lock);
+    
+    if (!success) {
+        NSLog(@"%@", [NSString stringWithFormat:@"写入文件失败, key: %@, %@", key, error]);
+    }
+    return success;
+}
+
+- (BOOL)removeItemForKey:(NSString *)key {
+    NSParameterAssert(key);
+    if (!key) {
+        return NO;
+    }
+    
+    NSError *error = nil;
+    pthread_mutex_lock(&_lock);
+    [self.mappedDataCache removeObjectForKey:key];
+    BOOL success = [[NSFileManager defaultManager] removeItemAtURL:[self internalFileURLForKey:key] error:&error];
+    pthread_mutex_unlock(&_lock);
+    
+    // 文件本来就不存在也算删除成功.
+    return success || ([error.domain isEqualToString:NSCocoaErrorDomain] && error.code == NSFileNoSuchFileError);
+}
+
+
+#pragma mark - Private
+
+- (NSURL *)internalFileURLForKey:(NSString *)key {
+    // key 中可能有 `/` 等不能出现在文件名中的字符.
+    static NSCharacterSet *allowedCharacters = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableCharacterSet *characterSet = [NSMutableCharacterSet alphanumericCharacterSet];
+        [characterSet addCharactersInString:@"-_"];
+        allowedCharacters = characterSet.copy;
+    });
+    NSString *fileName = [key stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacters];
+    return [self.directoryURL URLByAppendingPathComponent:fileName isDirectory:NO];
+}
+
+@end
+
+@interface BLWalletMemoryStorageBackend()
+
+@property (nonatomic) pthread_mutex_t lock;
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSData *> *items;
+
+@end
+
+@implementation BLWalletMemoryStorageBackend
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _items = [NSMutableDictionary dictionary];
+        pthread_mutex_init(&(_lock), NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSData *)dataForKey:(NSString *)key {
+    NSParameterAssert(key);
+    if (!key) {
+        return nil;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    NSData *data = self.items[key];
+    pthread_mutex_unlock(&_lock);
+    return data;
+}
+
+- (BOOL)setData:(NSData *)data forKey:(NSString *)key {
+    NSParameterAssert(data);
+    NSParameterAssert(key);
+    if (!data || !key) {
+        return NO;
+    }
+    
+    // 保存一份独立的数据, 不和调用方共用同一个对象, 回读确认对比的是存下来的字节.
+    NSData *dataCopy = [NSData dataWithBytes:data.bytes length:data.length];
+    pthread_mutex_lock(&_lock);
+    self.items[key] = dataCopy;
+    pthread_mutex_unlock(&_lock);
+    return YES;
+}
+
+- (BOOL)removeItemForKey:(NSString *)key {
+    NSParameterAssert(key);
+    if (!key) {
+        return NO;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    [self.items removeObjectForKey:key];
+    pthread_mutex_unlock(&_lock);
+    return YES;
+}
+
+@end
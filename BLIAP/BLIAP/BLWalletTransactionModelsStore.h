@@ -0,0 +1,206 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+#import "BLWalletCompat.h"
+#import "BLWalletStorageBackend.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class BLPaymentTransactionModel;
+
+/**
+ * 批量修改.
+ *
+ * 在 `-bl_performBatchUpdatesForUser:usingBlock:` 的 block 中按顺序记录任意多个新增 / 修改 / 删除操作, block 返回以后一次性持久化.
+ *
+ * @warning 不要在 block 之外持有和使用 batch.
+ */
+@interface BLWalletTransactionModelsBatch : NSObject
+
+/**
+ * 存储交易模型.
+ */
+- (void)savePaymentTransactionModel:(BLPaymentTransactionModel *)model;
+
+/**
+ * 删除指定 `transactionIdentifier` 的交易模型.
+ */
+- (void)deletePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier;
+
+/**
+ * 改变某笔交易的验证次数.
+ */
+- (void)updatePaymentModelVerifyCountWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                              modelVerifyCount:(NSUInteger)modelVerifyCount;
+
+/**
+ * 存储某笔交易的订单号和订单价格以及 md5 值, 价格为空时保留原来的价格.
+ */
+- (void)savePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                     orderNo:(NSString *)orderNo
+                                              priceTagString:(nullable NSString *)priceTagString
+                                                         md5:(NSString *)md5;
+
+/**
+ * 改变某笔交易的验证状态.
+ */
+- (void)updatePaymentTransactionModelStateWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                      isTransactionValidFromService:(BOOL)isTransactionValidFromService;
+
+@end
+
+@protocol BLWalletTransactionModelsSaveProtocol<NSObject>
+
+@optional
+
+/**
+ * 存储交易模型.
+ *
+ * @param models 交易模型. @see `BLPaymentTransactionModel`
+ * @param userid 用户 id.
+ */
+- (void)bl_savePaymentTransactionModels:(NSArray<BLPaymentTransactionModel *> *)models
+                                forUser:(NSString *)userid;
+
+/**
+ * 删除指定 `transactionIdentifier` 的交易模型.
+ *
+ * @param transactionIdentifier 交易模型唯一标识.
+ * @param userid                用户 id.
+ *
+ * @return 是否删除成功. 失败的原因可能是因为标识无效(已存储数据中没有指定的标识的数据).
+ */
+- (BOOL)bl_deletePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                          forUser:(NSString *)userid;
+
+/**
+ * 删除所有的 `transactionIdentifier` 交易模型.
+ *
+ * @param userid 用户 id.
+ */
+- (void)bl_deleteAllPaymentTransactionModelsIfNeedForUser:(NSString *)userid;
+
+/**
+ * 获取所有交易模型, 并排序.
+ *
+ * @return models 交易模型. @see `BLPaymentTransactionModel`
+ * @param userid  用户 id.
+ */
+- (NSArray<BLPaymentTransactionModel *> * _Nullable)bl_fetchAllPaymentTransactionModelsSortedArrayUsingComparator:(NSComparator NS_NOESCAPE _Nullable)cmptr
+                                                                                                          forUser:(NSString *)userid
+                                                                                                            error:(NSError * __nullable __autoreleasing * __nullable)error;
+
+/**
+ * 获取所有交易模型.
+ *
+ * @param userid 用户 id.
+ *
+ * @return models 交易模型. @see `BLPaymentTransactionModel`
+ */
+- (NSArray<BLPaymentTransactionModel *> * _Nullable)bl_fetchAllPaymentTransactionModelsForUser:(NSString *)userid
+                                                                                         error:(NSError * __nullable __autoreleasing * __nullable)error;
+
+/**
+ * 获取指定 `transactionIdentifier` 的交易模型, 不需要遍历所有交易.
+ *
+ * @param transactionIdentifier 交易 id.
+ * @param userid                用户 id.
+ *
+ * @return 交易模型, 不存在时返回 nil. @see `BLPaymentTransactionModel`
+ */
+- (BLPaymentTransactionModel * _Nullable)bl_fetchPaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                                                         forUser:(NSString *)userid;
+
+/**
+ * 改变某笔交易的验证次数.
+ *
+ * @param transactionIdentifier 交易模型唯一标识.
+ * @param modelVerifyCount      交易验证次数.
+ * @param userid                用户 id.
+ */
+- (void)bl_updatePaymentModelVerifyCountWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                      modelVerifyCount:(NSUInteger)modelVerifyCount
+                                                               forUser:(NSString *)userid;
+
+/**
+ * 存储某笔交易的订单号和订单价格以及 md5 值.
+ *
+ * @param transactionIdentifier 交易模型唯一标识.
+ * @param orderNo               订单号.
+ * @param priceTagString        订单价格, 为空时保留原来的价格.
+ * @param md5                   交易收据是否有变动的标识.
+ * @param userid                用户 id.
+ */
+- (void)bl_savePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                        orderNo:(NSString *)orderNo
+                                                 priceTagString:(nullable NSString *)priceTagString
+                                                            md5:(NSString *)md5
+                                                        forUser:(NSString *)userid;
+
+/**
+ * 改变某笔交易的验证状态.
+ *
+ * @param transactionIdentifier         交易模型唯一标识.
+ * @param isTransactionValidFromService 交易是否已经和后台验证过.
+ * @param userid                        用户 id.
+ */
+- (void)bl_updatePaymentTransactionModelStateWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                      isTransactionValidFromService:(NSUInteger)isTransactionValidFromService
+                                                               forUser:(NSString *)userid;
+
+/**
+ * 批量修改某个用户的交易, 所有修改合并为一次持久化写入.
+ *
+ * @param userid 用户 id.
+ * @param block  在 block 中通过 batch 记录修改, block 返回以后统一提交.
+ */
+- (void)bl_performBatchUpdatesForUser:(NSString *)userid
+                           usingBlock:(void(NS_NOESCAPE ^)(BLWalletTransactionModelsBatch *batch))block;
+
+@end
+
+/**
+ * 存储结构为: 快照(每个用户一个索引条目 + 每笔交易一个记录条目) + 只追加的日志.
+ *
+ * 所有数据都通过 `BLWalletStorageBackend` 读写, 存储介质可以是 keychain, 内存映射文件或者内存.
+ *
+ * 索引: key 为 `com.wallet.models.keychain.store.www.index.<userid>`, 记录该用户所有 transactionIdentifier 以及快照包含的最后一条日志序号.
+ * 记录: key 为 `com.wallet.models.keychain.store.www.record.<userid>.<transactionIdentifier>`, 是单个 model 的编码数据.
+ * 日志: key 为 `com.wallet.models.keychain.store.www.journal.<userid>.<sequence>`, 每次修改(新增 / 修改字段 / 删除)只追加一条日志.
+ *
+ * 日志累积到一定条数以后在后台合并到快照, 然后删除已经合并的日志. 启动时读取快照并回放快照之后的日志.
+ *
+ * 每条日志带有 generation(日志序号) 和校验和, 写入以后只回读这一条日志确认. 索引记录每条交易记录的校验和.
+ * 重新加载整个用户数据的完整检查只在 DEBUG 下或者抽样执行.
+ *
+ * @warning 旧版本的数据结构(所有用户共用的 dict - set - model, 以及每个用户一个 set - model)会在第一次访问时一次性迁移到当前结构.
+ */
+@interface BLWalletTransactionModelsStore : NSObject<BLWalletTransactionModelsSaveProtocol>
+
+/**
+ * 存储介质.
+ */
+@property(nonatomic, strong, readonly) id<BLWalletStorageBackend> backend;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 初始化方法.
+ *
+ * @param backend 存储介质. @see `BLWalletKeyChainStorageBackend`, `BLWalletFileStorageBackend`, `BLWalletMemoryStorageBackend`.
+ */
+- (instancetype)initWithBackend:(id<BLWalletStorageBackend>)backend NS_DESIGNATED_INITIALIZER;
+
+@end
+
+NS_ASSUME_NONNULL_END
+
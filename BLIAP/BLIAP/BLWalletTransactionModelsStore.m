@@ -0,0 +1,1240 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLWalletTransactionModelsStore.h"
+#import "BLPaymentTransactionModel.h"
+#import <pthread.h>
+#import "BLWalletCompat.h"
+
+typedef NS_ENUM(uint8_t, BLWalletJournalOperation) { // 日志操作类型.
+    BLWalletJournalOperationAdd = 1, // 新增交易, 携带完整的交易数据.
+    BLWalletJournalOperationUpdate = 2, // 修改交易字段, 携带修改以后的交易数据.
+    BLWalletJournalOperationDelete = 3 // 删除交易, 携带 transactionIdentifier.
+};
+
+/**
+ * 一条日志操作.
+ */
+@interface BLWalletJournalRecord : NSObject
+
+@property(nonatomic, assign) BLWalletJournalOperation operation;
+
+@property(nonatomic, copy) NSString *transactionIdentifier;
+
+@property(nonatomic, strong, nullable) BLPaymentTransactionModel *model;
+
++ (instancetype)recordWithOperation:(BLWalletJournalOperation)operation model:(BLPaymentTransactionModel *)model;
+
++ (instancetype)deleteRecordWithTransactionIdentifier:(NSString *)transactionIdentifier;
+
+@end
+
+@implementation BLWalletJournalRecord
+
++ (instancetype)recordWithOperation:(BLWalletJournalOperation)operation model:(BLPaymentTransactionModel *)model {
+    BLWalletJournalRecord *record = [BLWalletJournalRecord new];
+    record.operation = operation;
+    record.transactionIdentifier = model.transactionIdentifier;
+    record.model = model;
+    return record;
+}
+
++ (instancetype)deleteRecordWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    BLWalletJournalRecord *record = [BLWalletJournalRecord new];
+    record.operation = BLWalletJournalOperationDelete;
+    record.transactionIdentifier = transactionIdentifier;
+    return record;
+}
+
+@end
+
+typedef BLWalletJournalRecord * _Nullable (^BLWalletBatchChange)(NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier);
+
+@interface BLWalletTransactionModelsBatch()
+
+/**
+ * 按顺序记录的修改, 提交时根据当时的模型生成日志操作.
+ */
+@property(nonatomic, strong) NSMutableArray<BLWalletBatchChange> *changes;
+
+@end
+
+@implementation BLWalletTransactionModelsBatch
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _changes = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)savePaymentTransactionModel:(BLPaymentTransactionModel *)model {
+    NSParameterAssert(model);
+    if (!model) {
+        return;
+    }
+    
+    BLPaymentTransactionModel *modelCopy = [model copy];
+    [self.changes addObject:^BLWalletJournalRecord *(NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier) {
+        
+        // 检查一下 keychain 中是否已经存在当前 model.
+        if ([modelsByTransactionIdentifier[modelCopy.transactionIdentifier] isEqual:modelCopy]) {
+            NSLog(@"keychain 中已经有: %@, 不用再存一遍.", modelCopy);
+            return nil;
+        }
+        return [BLWalletJournalRecord recordWithOperation:BLWalletJournalOperationAdd model:modelCopy];
+        
+    }];
+}
+
+- (void)deletePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier) {
+        return;
+    }
+    
+    [self.changes addObject:^BLWalletJournalRecord *(NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier) {
+        
+        if (!modelsByTransactionIdentifier[transactionIdentifier]) {
+            return nil;
+        }
+        return [BLWalletJournalRecord deleteRecordWithTransactionIdentifier:transactionIdentifier];
+        
+    }];
+}
+
+- (void)updatePaymentModelVerifyCountWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                              modelVerifyCount:(NSUInteger)modelVerifyCount {
+    [self updateModelWithTransactionIdentifier:transactionIdentifier usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.modelVerifyCount = modelVerifyCount;
+        
+    }];
+}
+
+- (void)savePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                     orderNo:(NSString *)orderNo
+                                              priceTagString:(nullable NSString *)priceTagString
+                                                         md5:(NSString *)md5 {
+    NSParameterAssert(orderNo);
+    if (!orderNo) {
+        return;
+    }
+    
+    // 价格是后台返回的, 可能缺失, 缺失时保留原来的价格, 订单号照样保存, 避免重复创建订单.
+    [self updateModelWithTransactionIdentifier:transactionIdentifier usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.orderNo = orderNo;
+        if (priceTagString) {
+            model.priceTagString = priceTagString;
+        }
+        model.md5 = md5;
+        
+    }];
+}
+
+- (void)updatePaymentTransactionModelStateWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                      isTransactionValidFromService:(BOOL)isTransactionValidFromService {
+    [self updateModelWithTransactionIdentifier:transactionIdentifier usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.isTransactionValidFromService = isTransactionValidFromService;
+        
+    }];
+}
+
+- (void)updateModelWithTransactionIdentifier:(NSString *)transactionIdentifier usingBlock:(void(^)(BLPaymentTransactionModel *model))block {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier) {
+        return;
+    }
+    
+    [self.changes addObject:^BLWalletJournalRecord *(NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier) {
+        
+        BLPaymentTransactionModel *model = [modelsByTransactionIdentifier[transactionIdentifier] copy];
+        if (!model) {
+            NSLog(@"%@", [NSString stringWithFormat:@"keychain 不存在 transactionIdentifier 为: %@ 的数据.", transactionIdentifier]);
+            return nil;
+        }
+        block(model);
+        return [BLWalletJournalRecord recordWithOperation:BLWalletJournalOperationUpdate model:model];
+        
+    }];
+}
+
+@end
+
+/**
+ * 某个用户在内存中的存储状态.
+ */
+@interface BLWalletKeyChainStoreUserState : NSObject
+
+/**
+ * 已解档的交易模型(快照 + 日志回放以后的最新状态), 按存入的先后顺序排列.
+ */
+@property(nonatomic, copy, readonly) NSArray<BLPaymentTransactionModel *> *models;
+
+/**
+ * 以 transactionIdentifier 为 key 的索引, 查找和修改都不需要遍历.
+ */
+@property(nonatomic, strong, readonly) NSMutableDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier;
+
+/**
+ * 最后一条日志的序号.
+ */
+@property(nonatomic, assign) uint64_t lastSequence;
+
+/**
+ * 快照已经包含的最后一条日志的序号.
+ */
+@property(nonatomic, assign) uint64_t checkpointSequence;
+
+/**
+ * 回放时跳过的无法解码的日志序号.
+ * lastSequence 已经越过这些日志, 新的日志不会覆盖它们, 加载时隔离保存一份, 原来的日志在合并时删除.
+ */
+@property(nonatomic, strong) NSMutableArray<NSNumber *> *damagedJournalSequences;
+
+/**
+ * 快照之后有改动的交易.
+ */
+@property(nonatomic, strong) NSMutableSet<NSString *> *dirtyTransactionIdentifiers;
+
+/**
+ * 是否已经安排了合并任务.
+ */
+@property(nonatomic, assign) BOOL compactionScheduled;
+
+/**
+ * 快照中每条交易记录的校验和, 以 transactionIdentifier 为 key, 和索引一起写入.
+ */
+@property(nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *recordChecksums;
+
+/**
+ * 复制一份只包含交易模型的状态, 用于批量修改时在副本上生成日志操作.
+ */
+- (instancetype)modelsOnlyCopy;
+
+/**
+ * 新增或者覆盖一笔交易.
+ */
+- (void)setModel:(BLPaymentTransactionModel *)model;
+
+/**
+ * 删除一笔交易.
+ */
+- (void)removeModelWithTransactionIdentifier:(NSString *)transactionIdentifier;
+
+@end
+
+@interface BLWalletKeyChainStoreUserState()
+
+/**
+ * 交易存入的先后顺序.
+ */
+@property(nonatomic, strong) NSMutableOrderedSet<NSString *> *transactionIdentifiers;
+
+/**
+ * models 的缓存, 交易有变化时失效.
+ */
+@property(nonatomic, copy, nullable) NSArray<BLPaymentTransactionModel *> *modelsCache;
+
+@end
+
+@implementation BLWalletKeyChainStoreUserState
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _modelsByTransactionIdentifier = [NSMutableDictionary dictionary];
+        _transactionIdentifiers = [NSMutableOrderedSet orderedSet];
+        _dirtyTransactionIdentifiers = [NSMutableSet set];
+        _recordChecksums = [NSMutableDictionary dictionary];
+        _damagedJournalSequences = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (instancetype)modelsOnlyCopy {
+    BLWalletKeyChainStoreUserState *state = [BLWalletKeyChainStoreUserState new];
+    [state.modelsByTransactionIdentifier addEntriesFromDictionary:self.modelsByTransactionIdentifier];
+    [state.transactionIdentifiers unionOrderedSet:self.transactionIdentifiers];
+    state.modelsCache = self.modelsCache;
+    return state;
+}
+
+- (NSArray<BLPaymentTransactionModel *> *)models {
+    if (!self.modelsCache) {
+        NSMutableArray<BLPaymentTransactionModel *> *modelsM = [NSMutableArray arrayWithCapacity:self.transactionIdentifiers.count];
+        for (NSString *transactionIdentifier in self.transactionIdentifiers) {
+            [modelsM addObject:self.modelsByTransactionIdentifier[transactionIdentifier]];
+        }
+        self.modelsCache = modelsM;
+    }
+    return self.modelsCache;
+}
+
+- (void)setModel:(BLPaymentTransactionModel *)model {
+    NSParameterAssert(model.transactionIdentifier);
+    if (!model.transactionIdentifier) {
+        return;
+    }
+    
+    self.modelsByTransactionIdentifier[model.transactionIdentifier] = model;
+    [self.transactionIdentifiers addObject:model.transactionIdentifier];
+    self.modelsCache = nil;
+}
+
+- (void)removeModelWithTransactionIdentifier:(NSString *)transactionIdentifier {
+    if (!self.modelsByTransactionIdentifier[transactionIdentifier]) {
+        return;
+    }
+    
+    [self.modelsByTransactionIdentifier removeObjectForKey:transactionIdentifier];
+    [self.transactionIdentifiers removeObject:transactionIdentifier];
+    self.modelsCache = nil;
+}
+
+@end
+
+/**
+ * 某个用户交易模型的不可变快照, 发布以后不再修改, 可以在任意线程不加锁读取.
+ */
+@interface BLWalletKeyChainStoreSnapshot : NSObject
+
+@property(nonatomic, copy, readonly) NSArray<BLPaymentTransactionModel *> *models;
+
+@property(nonatomic, copy, readonly) NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsByTransactionIdentifier;
+
+- (instancetype)initWithUserState:(BLWalletKeyChainStoreUserState *)state;
+
+@end
+
+@implementation BLWalletKeyChainStoreSnapshot
+
+- (instancetype)initWithUserState:(BLWalletKeyChainStoreUserState *)state {
+    self = [super init];
+    if (self) {
+        // 状态里的模型只会被整体替换, 不会原地修改, 快照直接引用即可.
+        _models = state.models;
+        _modelsByTransactionIdentifier = [state.modelsByTransactionIdentifier copy];
+    }
+    return self;
+}
+
+@end
+
+@interface BLWalletTransactionModelsStore()
+
+/**
+ * 写锁, 同一时间只有一个写者.
+ *
+ * 读取交易模型不需要这个锁, 只需要读取已经发布的快照.
+ */
+@property (nonatomic) pthread_mutex_t lock;
+
+/**
+ * 每个用户的内存状态, 以 userid 为 key.
+ *
+ * @warning 只能在持有 lock 的情况下访问. 所有写操作都会同时更新内存状态和 keychain.
+ */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, BLWalletKeyChainStoreUserState *> *userStates;
+
+/**
+ * 已经发布的快照, 以 userid 为 key.
+ *
+ * 写者在持有 lock 的情况下生成新的字典整体替换, 读者原子读取当前字典, 不需要加锁.
+ */
+@property (atomic, copy) NSDictionary<NSString *, BLWalletKeyChainStoreSnapshot *> *snapshots;
+
+/**
+ * 是否已经检查过旧版本的全局存储并完成迁移.
+ */
+@property (nonatomic, assign) BOOL legacyStoreMigrated;
+
+/**
+ * 日志合并队列.
+ */
+@property (nonatomic, strong) dispatch_queue_t compactionQueue;
+
+@end
+
+// 旧版本所有用户共用的 keychain key, 只在迁移时使用.
+static NSString *const kBLWalletModelsKeyChainStore = @"com.wallet.models.keychain.store.www";
+// 日志条数达到这个值以后合并到快照.
+static const uint64_t kBLWalletJournalCompactionThreshold = 16;
+// 日志数据格式.
+static const uint8_t kBLWalletJournalMagic[2] = {'B', 'J'};
+static const uint8_t kBLWalletJournalVersion = 3;
+// 从版本 2 开始, 日志头部带有 generation(日志序号) 和校验和.
+static const uint8_t kBLWalletJournalChecksumVersion = 2;
+// 从版本 3 开始, 操作条数是 4 字节, 一次批量删除超过 65535 条交易时不会溢出.
+static const uint8_t kBLWalletJournalWideCountVersion = 3;
+// 版本 3 的头部长度: magic(2) + version(1) + count(4) + generation(8) + checksum(4).
+static const NSUInteger kBLWalletJournalHeaderLength = 19;
+// release 版本中每多少次写入做一次完整的回读检查.
+static const uint32_t kBLWalletFullAuditSampleRate = 100;
+
+// FNV-1a 校验和, 用来快速确认写入的数据.
+static uint32_t BLWalletChecksum(const uint8_t *bytes, NSUInteger length) {
+    uint32_t hash = 2166136261u;
+    for (NSUInteger i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+@implementation BLWalletTransactionModelsStore
+
+- (instancetype)init {
+    NSAssert(NO, @"请使用指定的方法初始化");
+    return [self initWithBackend:[BLWalletMemoryStorageBackend new]];
+}
+
+- (instancetype)initWithBackend:(id<BLWalletStorageBackend>)backend {
+    NSParameterAssert(backend);
+    self = [super init];
+    if (self) {
+        _backend = backend;
+        pthread_mutex_init(&(_lock), NULL);
+        _userStates = [NSMutableDictionary dictionary];
+        _snapshots = @{};
+        _compactionQueue = dispatch_queue_create("com.ibeiliao.wallet.keychain.compaction.queue", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+
+#pragma mark - BLWalletTransactionModelsSaveProtocol
+
+- (void)bl_savePaymentTransactionModels:(NSArray<BLPaymentTransactionModel *> *)models
+                                forUser:(nonnull NSString *)userid {
+    NSParameterAssert(userid);
+    if (!models.count || !userid.length) {
+        return;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = [self internalStateForUser:userid];
+    NSMutableArray<BLWalletJournalRecord *> *records = [NSMutableArray array];
+    for (BLPaymentTransactionModel *model in models) {
+        // 检查一下 keychain 中是否已经存在当前 model.
+        if ([state.modelsByTransactionIdentifier[model.transactionIdentifier] isEqual:model]) {
+            NSLog(@"keychain 中已经有: %@, 不用再存一遍.", model);
+            continue;
+        }
+        
+        // 相同 transactionIdentifier 的交易直接覆盖.
+        [records addObject:[BLWalletJournalRecord recordWithOperation:BLWalletJournalOperationAdd model:[model copy]]];
+    }
+    
+    // 所有新增交易写入同一条日志.
+    if (records.count) {
+        [self internalAppendJournalRecords:records toState:state forUser:userid];
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    // 写入已经通过校验和确认, 完整的回读检查只在 DEBUG 或者抽样时执行.
+    if ([self internalShouldRunFullAudit]) {
+        [self internalCheckModelsSaveResult:models userid:userid];
+    }
+}
+
+- (BOOL)bl_deletePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                          forUser:(nonnull NSString *)userid {
+    if (!transactionIdentifier || !userid) {
+        return NO;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = [self internalStateForUser:userid];
+    if (!state.modelsByTransactionIdentifier[transactionIdentifier]) {
+        pthread_mutex_unlock(&_lock);
+        NSLog(@"%@", [NSString stringWithFormat:@"keychain 不存在 transactionIdentifier 为: %@ 的数据.", transactionIdentifier]);
+        return NO;
+    }
+    
+    [self internalAppendJournalRecords:@[[BLWalletJournalRecord deleteRecordWithTransactionIdentifier:transactionIdentifier]] toState:state forUser:userid];
+    pthread_mutex_unlock(&_lock);
+    
+    // 写入已经通过校验和确认, 完整的回读检查只在 DEBUG 或者抽样时执行.
+    if ([self internalShouldRunFullAudit]) {
+        [self internalCheckModelsDeleteResultWithTransactionIdentifier:transactionIdentifier userid:userid];
+    }
+    
+    return YES;
+}
+
+- (void)bl_deleteAllPaymentTransactionModelsIfNeedForUser:(NSString *)userid {
+    NSParameterAssert(userid);
+    if (!userid) {
+        return;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = [self internalStateForUser:userid];
+    NSMutableArray<BLWalletJournalRecord *> *records = [NSMutableArray arrayWithCapacity:state.modelsByTransactionIdentifier.count];
+    for (NSString *transactionIdentifier in state.modelsByTransactionIdentifier) {
+        [records addObject:[BLWalletJournalRecord deleteRecordWithTransactionIdentifier:transactionIdentifier]];
+    }
+    if (records.count) {
+        [self internalAppendJournalRecords:records toState:state forUser:userid];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSArray<BLPaymentTransactionModel *> *)bl_fetchAllPaymentTransactionModelsForUser:(NSString *)userid
+                                                                               error:(NSError *__autoreleasing  _Nullable *)error {
+    NSParameterAssert(userid);
+    
+    if (!userid) {
+       NSError *e = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"userid 为空"}];
+        if (error) {
+            *error = e;
+        }
+        return nil;
+    }
+    
+    NSArray<BLPaymentTransactionModel *> *models = [self internalSnapshotForUser:userid].models;
+    if (!models.count) {
+        NSError *e = [NSError errorWithDomain:BLWalletErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"keychain 中没有 userID 为 %@ 的数据", userid]}];
+        if (error) {
+            *error = e;
+        }
+        return nil;
+    }
+    
+    // 缓存里的模型只能由 store 修改, 返回副本给外部.
+    NSMutableArray<BLPaymentTransactionModel *> *arrM = [NSMutableArray arrayWithCapacity:models.count];
+    for (BLPaymentTransactionModel *model in models) {
+        [arrM addObject:[model copy]];
+    }
+    return arrM.copy;
+}
+
+- (NSArray<BLPaymentTransactionModel *> *)bl_fetchAllPaymentTransactionModelsSortedArrayUsingComparator:(NSComparator)cmptr
+                                                                                                forUser:(nonnull NSString *)userid
+                                                                                                  error:(NSError *__autoreleasing  _Nullable * _Nullable)error {
+    NSParameterAssert(userid);
+    if (!userid) {
+        return nil;
+    }
+    
+    NSArray<BLPaymentTransactionModel *> *models = [self bl_fetchAllPaymentTransactionModelsForUser:userid error:error];
+    if (!models.count) {
+        return nil;
+    }
+    
+    if (models.count == 1 || !cmptr) {
+        return models;
+    }
+    
+    if (cmptr) {
+        return [models sortedArrayUsingComparator:cmptr];
+    }
+    
+    return models;
+}
+
+- (BLPaymentTransactionModel *)bl_fetchPaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                                               forUser:(NSString *)userid {
+    NSParameterAssert(transactionIdentifier);
+    NSParameterAssert(userid);
+    if (!transactionIdentifier || !userid) {
+        return nil;
+    }
+    
+    BLPaymentTransactionModel *model = [self internalSnapshotForUser:userid].modelsByTransactionIdentifier[transactionIdentifier];
+    
+    // 缓存里的模型只能由 store 修改, 返回副本给外部.
+    return [model copy];
+}
+
+- (void)bl_updatePaymentModelVerifyCountWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                      modelVerifyCount:(NSUInteger)modelVerifyCount
+                                                               forUser:(nonnull NSString *)userid {
+    NSParameterAssert(transactionIdentifier);
+    NSParameterAssert(modelVerifyCount >= 0);
+    NSParameterAssert(userid);
+    
+    if (!transactionIdentifier || !userid) {
+        return;
+    }
+    
+    [self internalUpdateModelWithTransactionIdentifier:transactionIdentifier forUser:userid usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.modelVerifyCount = modelVerifyCount;
+        
+    }];
+}
+
+- (void)bl_savePaymentTransactionModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                                        orderNo:(NSString *)orderNo
+                                                 priceTagString:(nullable NSString *)priceTagString
+                                                            md5:(nonnull NSString *)md5
+                                                        forUser:(nonnull NSString *)userid {
+    NSParameterAssert(transactionIdentifier);
+    NSParameterAssert(orderNo);
+    NSParameterAssert(userid);
+    
+    if (!transactionIdentifier || !orderNo || !userid) {
+        return;
+    }
+    
+    // 价格是后台返回的, 可能缺失, 缺失时保留原来的价格, 订单号照样保存, 避免重复创建订单.
+    [self internalUpdateModelWithTransactionIdentifier:transactionIdentifier forUser:userid usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.orderNo = orderNo;
+        if (priceTagString) {
+            model.priceTagString = priceTagString;
+        }
+        model.md5 = md5;
+        
+    }];
+}
+
+- (void)bl_updatePaymentTransactionModelStateWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                         isTransactionValidFromService:(NSUInteger)isTransactionValidFromService
+                                                               forUser:(NSString *)userid {
+    NSParameterAssert(transactionIdentifier);
+    NSParameterAssert(userid);
+    
+    if (!transactionIdentifier || !userid) {
+        return;
+    }
+    
+    [self internalUpdateModelWithTransactionIdentifier:transactionIdentifier forUser:userid usingBlock:^(BLPaymentTransactionModel *model) {
+        
+        model.isTransactionValidFromService = isTransactionValidFromService;
+        
+    }];
+}
+
+- (void)bl_performBatchUpdatesForUser:(NSString *)userid
+                           usingBlock:(void(NS_NOESCAPE ^)(BLWalletTransactionModelsBatch *batch))block {
+    NSParameterAssert(userid);
+    NSParameterAssert(block);
+    if (!userid || !block) {
+        return;
+    }
+    
+    BLWalletTransactionModelsBatch *batch = [BLWalletTransactionModelsBatch new];
+    block(batch);
+    if (!batch.changes.count) {
+        return;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = [self internalStateForUser:userid];
+    
+    // 按顺序在工作副本上生成日志操作, 后面的修改能看到前面修改的结果.
+    BLWalletKeyChainStoreUserState *workingState = [state modelsOnlyCopy];
+    NSMutableArray<BLWalletJournalRecord *> *records = [NSMutableArray arrayWithCapacity:batch.changes.count];
+    for (BLWalletBatchChange change in batch.changes) {
+        BLWalletJournalRecord *record = change(workingState.modelsByTransactionIdentifier);
+        if (record) {
+            [records addObject:record];
+            [self internalApplyJournalRecords:@[record] toState:workingState];
+        }
+    }
+    
+    // 整个 batch 只追加一条日志.
+    if (records.count) {
+        [self internalAppendJournalRecords:records toState:state forUser:userid];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+
+#pragma mark - Snapshot
+
+// 不需要持有 lock. 只有第一次读取某个用户时才需要加锁从 keychain 加载.
+- (BLWalletKeyChainStoreSnapshot *)internalSnapshotForUser:(NSString *)userid {
+    BLWalletKeyChainStoreSnapshot *snapshot = self.snapshots[userid];
+    if (snapshot) {
+        return snapshot;
+    }
+    
+    pthread_mutex_lock(&_lock);
+    [self internalStateForUser:userid];
+    snapshot = self.snapshots[userid];
+    pthread_mutex_unlock(&_lock);
+    return snapshot;
+}
+
+// 以下方法调用前必须持有 lock.
+
+- (void)internalPublishSnapshotForState:(BLWalletKeyChainStoreUserState *)state user:(NSString *)userid {
+    NSMutableDictionary<NSString *, BLWalletKeyChainStoreSnapshot *> *snapshotsM = [self.snapshots mutableCopy];
+    if (state) {
+        snapshotsM[userid] = [[BLWalletKeyChainStoreSnapshot alloc] initWithUserState:state];
+    }
+    else {
+        [snapshotsM removeObjectForKey:userid];
+    }
+    self.snapshots = snapshotsM;
+}
+
+
+#pragma mark - Private
+
+// 以下方法调用前必须持有 lock.
+
+- (BLWalletKeyChainStoreUserState *)internalStateForUser:(NSString *)userid {
+    BLWalletKeyChainStoreUserState *state = self.userStates[userid];
+    if (!state) {
+        state = [self internalLoadStateFromKeychainForUser:userid];
+        self.userStates[userid] = state;
+        [self internalPublishSnapshotForState:state user:userid];
+        [self internalScheduleCompactionIfNeedForState:state user:userid];
+    }
+    return state;
+}
+
+- (void)internalUpdateModelWithTransactionIdentifier:(NSString *)transactionIdentifier
+                                             forUser:(NSString *)userid
+                                          usingBlock:(void(^)(BLPaymentTransactionModel *model))block {
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = [self internalStateForUser:userid];
+    // 在副本上修改, 写入失败时缓存不受影响.
+    BLPaymentTransactionModel *model = [state.modelsByTransactionIdentifier[transactionIdentifier] copy];
+    if (!model) {
+        pthread_mutex_unlock(&_lock);
+        NSLog(@"%@", [NSString stringWithFormat:@"keychain 不存在 transactionIdentifier 为: %@ 的数据.", transactionIdentifier]);
+        return;
+    }
+    
+    block(model);
+    
+    // 只追加一条日志, 不改写快照.
+    [self internalAppendJournalRecords:@[[BLWalletJournalRecord recordWithOperation:BLWalletJournalOperationUpdate model:model]] toState:state forUser:userid];
+    pthread_mutex_unlock(&_lock);
+}
+
+
+#pragma mark - Journal
+
+- (BOOL)internalAppendJournalRecords:(NSArray<BLWalletJournalRecord *> *)records
+                             toState:(BLWalletKeyChainStoreUserState *)state
+                             forUser:(NSString *)userid {
+    uint64_t sequence = state.lastSequence + 1;
+    NSData *data = [self internalEncodeJournalRecords:records sequence:sequence];
+    if (!data) {
+        // 模型编码失败, 没有写入任何数据, 缓存和快照都不受影响.
+        NSLog(@"%@", [NSString stringWithFormat:@"编码 keychain 日志失败, userID: %@, sequence: %llu", userid, sequence]);
+        return NO;
+    }
+    
+    NSString *key = [self internalJournalKeyForUser:userid sequence:sequence];
+    
+    // 追加日志是一次新增操作, 不会删除或者改写已有的数据.
+    // 写入以后只回读这一条日志, 对比完整的数据确认写入成功.
+    BOOL success = [self.backend setData:data forKey:key] && [self internalConfirmJournalData:data forKey:key];
+    if (!success) {
+        // 写入失败, 下次写入时从 keychain 重新加载. 已经发布的快照仍然是上一次确认写入的数据, 读取不需要等待重新加载.
+        [self.userStates removeObjectForKey:userid];
+        NSLog(@"%@", [NSString stringWithFormat:@"追加 keychain 日志失败, userID: %@, sequence: %llu", userid, sequence]);
+        return NO;
+    }
+    
+    state.lastSequence = sequence;
+    [self internalApplyJournalRecords:records toState:state];
+    [self internalPublishSnapshotForState:state user:userid];
+    [self internalScheduleCompactionIfNeedForState:state user:userid];
+    return YES;
+}
+
+- (void)internalApplyJournalRecords:(NSArray<BLWalletJournalRecord *> *)records toState:(BLWalletKeyChainStoreUserState *)state {
+    for (BLWalletJournalRecord *record in records) {
+        switch (record.operation) {
+            case BLWalletJournalOperationAdd:
+            case BLWalletJournalOperationUpdate:
+                [state setModel:record.model];
+                break;
+            
+            case BLWalletJournalOperationDelete:
+                [state removeModelWithTransactionIdentifier:record.transactionIdentifier];
+                break;
+        }
+        [state.dirtyTransactionIdentifiers addObject:record.transactionIdentifier];
+    }
+}
+
+- (void)internalScheduleCompactionIfNeedForState:(BLWalletKeyChainStoreUserState *)state user:(NSString *)userid {
+    if (state.compactionScheduled || state.lastSequence - state.checkpointSequence < kBLWalletJournalCompactionThreshold) {
+        return;
+    }
+    
+    state.compactionScheduled = YES;
+    __weak typeof(self) wself = self;
+    dispatch_async(self.compactionQueue, ^{
+        
+        __strong typeof(wself) sself = wself;
+        if (!sself) return;
+        [sself compactJournalForUser:userid];
+        
+    });
+}
+
+// 将日志合并到快照(交易记录 + 索引), 然后删除已经合并的日志.
+// 在后台队列执行, 整个过程持有 lock, 保证加载数据时不会读到合并了一半的快照.
+- (void)compactJournalForUser:(NSString *)userid {
+    pthread_mutex_lock(&_lock);
+    BLWalletKeyChainStoreUserState *state = self.userStates[userid];
+    if (!state) {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+    state.compactionScheduled = NO;
+    
+    uint64_t previousCheckpointSequence = state.checkpointSequence;
+    uint64_t checkpointSequence = state.lastSequence;
+    if (checkpointSequence == previousCheckpointSequence) {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+    
+    // 1. 写入有改动的交易记录.
+    BOOL success = YES;
+    NSMutableArray<NSString *> *deletedTransactionIdentifiers = [NSMutableArray array];
+    for (NSString *transactionIdentifier in state.dirtyTransactionIdentifiers) {
+        BLPaymentTransactionModel *model = state.modelsByTransactionIdentifier[transactionIdentifier];
+        if (!model) {
+            [deletedTransactionIdentifiers addObject:transactionIdentifier];
+            [state.recordChecksums removeObjectForKey:transactionIdentifier];
+            continue;
+        }
+        success = [self internalWriteRecordForModel:model recordChecksums:state.recordChecksums forUser:userid] && success;
+    }
+    
+    // 2. 写入索引, 同时记录快照已经包含的日志序号和每条记录的校验和. 记录没有全部写入成功时不更新索引, 日志保留, 下次重新合并.
+    success = success && [self internalWriteIndexForModels:state.models
+                                           recordChecksums:state.recordChecksums
+                                        checkpointSequence:checkpointSequence
+                                previousCheckpointSequence:previousCheckpointSequence
+                                                   forUser:userid];
+    if (!success) {
+        pthread_mutex_unlock(&_lock);
+        NSLog(@"%@", [NSString stringWithFormat:@"合并 keychain 日志失败, userID: %@", userid]);
+        return;
+    }
+    state.checkpointSequence = checkpointSequence;
+    [state.dirtyTransactionIdentifiers removeAllObjects];
+    
+    // 3. 删除已经不存在的交易记录和已经合并的日志.
+    for (NSString *transactionIdentifier in deletedTransactionIdentifiers) {
+        [self.backend removeItemForKey:[self internalRecordKeyForTransactionIdentifier:transactionIdentifier user:userid]];
+    }
+    [self internalRemoveJournalFromSequence:previousCheckpointSequence + 1 toSequence:checkpointSequence forUser:userid];
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)internalRemoveJournalFromSequence:(uint64_t)fromSequence toSequence:(uint64_t)toSequence forUser:(NSString *)userid {
+    for (uint64_t sequence = fromSequence; sequence <= toSequence; sequence++) {
+        [self.backend removeItemForKey:[self internalJournalKeyForUser:userid sequence:sequence]];
+    }
+}
+
+// 格式(小端序): magic(2) + version(1) + count(4) + generation(8) + checksum(4) + [operation(1) + length(4) + payload] * count.
+// generation 是日志序号, checksum 是所有操作数据的校验和. 版本 1 没有 generation 和 checksum, 版本 1 和 2 的 count 是 2 字节.
+// 交易模型编码失败时返回 nil.
+- (NSData *)internalEncodeJournalRecords:(NSArray<BLWalletJournalRecord *> *)records sequence:(uint64_t)sequence {
+    NSMutableData *body = [NSMutableData data];
+    for (BLWalletJournalRecord *record in records) {
+        uint8_t operation = record.operation;
+        NSData *payload = record.operation == BLWalletJournalOperationDelete ? [record.transactionIdentifier dataUsingEncoding:NSUTF8StringEncoding] : [record.model encodedData];
+        if (!payload) {
+            return nil;
+        }
+        
+        uint32_t length = CFSwapInt32HostToLittle((uint32_t)payload.length);
+        [body appendBytes:&operation length:sizeof(operation)];
+        [body appendBytes:&length length:sizeof(length)];
+        [body appendData:payload];
+    }
+    
+    NSMutableData *data = [NSMutableData dataWithCapacity:body.length + kBLWalletJournalHeaderLength];
+    [data appendBytes:kBLWalletJournalMagic length:sizeof(kBLWalletJournalMagic)];
+    [data appendBytes:&kBLWalletJournalVersion length:sizeof(kBLWalletJournalVersion)];
+    NSParameterAssert(records.count <= UINT32_MAX);
+    uint32_t count = CFSwapInt32HostToLittle((uint32_t)records.count);
+    [data appendBytes:&count length:sizeof(count)];
+    uint64_t generation = CFSwapInt64HostToLittle(sequence);
+    [data appendBytes:&generation length:sizeof(generation)];
+    uint32_t checksum = CFSwapInt32HostToLittle(BLWalletChecksum(body.bytes, body.length));
+    [data appendBytes:&checksum length:sizeof(checksum)];
+    [data appendData:body];
+    return data.copy;
+}
+
+// 解析日志头部, 版本 2 以上会校验 generation 和校验和. 返回操作数据的起始偏移, 数据无效时返回 NSNotFound.
+- (NSUInteger)internalValidateJournalData:(NSData *)data sequence:(uint64_t)sequence count:(uint32_t *)count {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger offset = sizeof(kBLWalletJournalMagic) + sizeof(kBLWalletJournalVersion);
+    if (length < offset || memcmp(bytes, kBLWalletJournalMagic, sizeof(kBLWalletJournalMagic)) != 0 || bytes[2] > kBLWalletJournalVersion) {
+        return NSNotFound;
+    }
+    
+    uint8_t version = bytes[2];
+    if (version >= kBLWalletJournalWideCountVersion) {
+        uint32_t wideCount;
+        if (length < offset + sizeof(wideCount)) {
+            return NSNotFound;
+        }
+        memcpy(&wideCount, bytes + offset, sizeof(wideCount));
+        offset += sizeof(wideCount);
+        *count = CFSwapInt32LittleToHost(wideCount);
+    }
+    else {
+        uint16_t narrowCount;
+        if (length < offset + sizeof(narrowCount)) {
+            return NSNotFound;
+        }
+        memcpy(&narrowCount, bytes + offset, sizeof(narrowCount));
+        offset += sizeof(narrowCount);
+        *count = CFSwapInt16LittleToHost(narrowCount);
+    }
+    if (version < kBLWalletJournalChecksumVersion) {
+        return offset;
+    }
+    
+    uint64_t generation;
+    uint32_t checksum;
+    if (length < offset + sizeof(generation) + sizeof(checksum)) {
+        return NSNotFound;
+    }
+    memcpy(&generation, bytes + offset, sizeof(generation));
+    offset += sizeof(generation);
+    memcpy(&checksum, bytes + offset, sizeof(checksum));
+    offset += sizeof(checksum);
+    if (CFSwapInt64LittleToHost(generation) != sequence || CFSwapInt32LittleToHost(checksum) != BLWalletChecksum(bytes + offset, length - offset)) {
+        return NSNotFound;
+    }
+    return offset;
+}
+
+- (NSArray<BLWalletJournalRecord *> *)internalDecodeJournalData:(NSData *)data sequence:(uint64_t)sequence {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    uint32_t count = 0;
+    NSUInteger offset = [self internalValidateJournalData:data sequence:sequence count:&count];
+    if (offset == NSNotFound) {
+        return nil;
+    }
+    
+    // count 来自数据本身, 每条操作至少 5 字节, 先用剩余长度检查, 不按损坏的 count 预先分配.
+    if (count > (length - offset) / (sizeof(uint8_t) + sizeof(uint32_t))) {
+        return nil;
+    }
+    
+    NSMutableArray<BLWalletJournalRecord *> *records = [NSMutableArray arrayWithCapacity:count];
+    for (uint32_t i = 0; i < count; i++) {
+        if (offset + sizeof(uint8_t) + sizeof(uint32_t) > length) {
+            return nil;
+        }
+        uint8_t operation = bytes[offset];
+        uint32_t payloadLength;
+        memcpy(&payloadLength, bytes + offset + 1, sizeof(payloadLength));
+        payloadLength = CFSwapInt32LittleToHost(payloadLength);
+        offset += sizeof(uint8_t) + sizeof(uint32_t);
+        if (offset + payloadLength > length) {
+            return nil;
+        }
+        NSData *payload = [data subdataWithRange:NSMakeRange(offset, payloadLength)];
+        offset += payloadLength;
+        
+        BLWalletJournalRecord *record = nil;
+        if (operation == BLWalletJournalOperationDelete) {
+            NSString *transactionIdentifier = [[NSString alloc] initWithData:payload encoding:NSUTF8StringEncoding];
+            record = transactionIdentifier.length ? [BLWalletJournalRecord deleteRecordWithTransactionIdentifier:transactionIdentifier] : nil;
+        }
+        else if (operation == BLWalletJournalOperationAdd || operation == BLWalletJournalOperationUpdate) {
+            BLPaymentTransactionModel *model = [[BLPaymentTransactionModel alloc] initWithEncodedData:payload];
+            record = model ? [BLWalletJournalRecord recordWithOperation:operation model:model] : nil;
+        }
+        if (!record) {
+            return nil;
+        }
+        [records addObject:record];
+    }
+    return records.copy;
+}
+
+
+#pragma mark - Snapshot
+
+// 加载某个用户的数据: 先迁移旧版本的存储, 读取以后删除上次合并没来得及删除的日志.
+- (BLWalletKeyChainStoreUserState *)internalLoadStateFromKeychainForUser:(NSString *)userid {
+    [self internalMigrateLegacyStoreIfNeed];
+    [self internalMigrateUserStoreIfNeed:userid];
+    
+    uint64_t previousCheckpointSequence = 0;
+    BLWalletKeyChainStoreUserState *state = [self internalReadStateFromKeychainForUser:userid previousCheckpointSequence:&previousCheckpointSequence];
+    if (state.checkpointSequence > previousCheckpointSequence && [self.backend dataForKey:[self internalJournalKeyForUser:userid sequence:state.checkpointSequence]]) {
+        [self internalRemoveJournalFromSequence:previousCheckpointSequence + 1 toSequence:state.checkpointSequence forUser:userid];
+    }
+    
+    // 回放跳过的日志隔离保存一份, 方便排查. 原来的日志和其他已经回放的日志一起在合并时删除.
+    for (NSNumber *sequence in state.damagedJournalSequences) {
+        NSData *data = [self.backend dataForKey:[self internalJournalKeyForUser:userid sequence:sequence.unsignedLongLongValue]];
+        if (data.length) {
+            [self.backend setData:data forKey:[self internalQuarantinedJournalKeyForUser:userid sequence:sequence.unsignedLongLongValue]];
+        }
+    }
+    return state;
+}
+
+// 只读取 keychain, 不迁移也不删除任何数据, 回读检查也用这个方法.
+- (BLWalletKeyChainStoreUserState *)internalReadStateFromKeychainForUser:(NSString *)userid previousCheckpointSequence:(uint64_t *)previousCheckpointSequence {
+    BLWalletKeyChainStoreUserState *state = [BLWalletKeyChainStoreUserState new];
+    
+    // 1. 读取快照.
+    NSData *indexData = [self.backend dataForKey:[self internalIndexKeyForUser:userid]];
+    id index = indexData.length ? [NSKeyedUnarchiver unarchiveObjectWithData:indexData] : nil;
+    NSArray<NSString *> *transactionIdentifiers = nil;
+    NSDictionary<NSString *, NSNumber *> *recordChecksums = nil;
+    if ([index isKindOfClass:[NSDictionary class]]) {
+        transactionIdentifiers = index[@"transactionIdentifiers"];
+        recordChecksums = index[@"recordChecksums"];
+        state.checkpointSequence = [index[@"checkpointSequence"] unsignedLongLongValue];
+        *previousCheckpointSequence = [index[@"previousCheckpointSequence"] unsignedLongLongValue];
+    }
+    else if ([index isKindOfClass:[NSArray class]]) {
+        // 没有日志的旧版本索引.
+        transactionIdentifiers = index;
+    }
+    
+    for (NSString *transactionIdentifier in transactionIdentifiers) {
+        NSParameterAssert([transactionIdentifier isKindOfClass:[NSString class]]);
+        NSData *data = [self.backend dataForKey:[self internalRecordKeyForTransactionIdentifier:transactionIdentifier user:userid]];
+        uint32_t checksum = BLWalletChecksum(data.bytes, data.length);
+        NSNumber *expectedChecksum = recordChecksums[transactionIdentifier];
+        if (data.length && expectedChecksum && expectedChecksum.unsignedIntValue != checksum) {
+            // 记录和快照不是同一次合并写入的, 或者数据损坏, 都不能解码, 损坏的数据甚至会让解码抛出异常. 直接丢弃.
+            // 合并失败留下的记录, 对应的日志还没有删除, 之后的日志回放会把这笔交易补回来.
+            NSLog(@"%@", [NSString stringWithFormat:@"keychain 交易记录校验和不匹配, 已丢弃, userID: %@, transactionIdentifier: %@, generation: %llu", userid, transactionIdentifier, state.checkpointSequence]);
+            continue;
+        }
+        BLPaymentTransactionModel *model = data.length ? [[BLPaymentTransactionModel alloc] initWithEncodedData:data] : nil;
+        if (model) {
+            [state setModel:model];
+            state.recordChecksums[transactionIdentifier] = @(checksum);
+        }
+        else {
+            NSLog(@"%@", [NSString stringWithFormat:@"keychain 索引中有 transactionIdentifier 为: %@ 的交易, 但是没有对应的数据.", transactionIdentifier]);
+        }
+    }
+    state.lastSequence = state.checkpointSequence;
+    
+    // 2. 回放快照之后的日志. 上次合并没来得及删除的日志序号不大于 checkpoint, 不会被回放.
+    for (uint64_t sequence = state.checkpointSequence + 1; ; sequence++) {
+        NSData *data = [self.backend dataForKey:[self internalJournalKeyForUser:userid sequence:sequence]];
+        if (!data.length) {
+            break;
+        }
+        NSArray<BLWalletJournalRecord *> *records = [self internalDecodeJournalData:data sequence:sequence];
+        if (!records) {
+            // 跳过无法解码的日志, 继续回放之后的日志. 日志里保存的都是完整的交易模型, 只会丢掉这一条日志的修改.
+            // lastSequence 越过这条日志, 新的日志不会覆盖它, 之后的写入和删除照常进行.
+            [state.damagedJournalSequences addObject:@(sequence)];
+            state.lastSequence = sequence;
+            NSLog(@"%@", [NSString stringWithFormat:@"keychain 日志数据损坏, 已跳过, userID: %@, sequence: %llu", userid, sequence]);
+            continue;
+        }
+        [self internalApplyJournalRecords:records toState:state];
+        state.lastSequence = sequence;
+    }
+    
+    return state;
+}
+
+- (NSString *)internalSetKeyForUser:(NSString *)userid {
+    return [NSString stringWithFormat:@"%@.%@", kBLWalletModelsKeyChainStore, userid];
+}
+
+- (NSString *)internalIndexKeyForUser:(NSString *)userid {
+    return [NSString stringWithFormat:@"%@.index.%@", kBLWalletModelsKeyChainStore, userid];
+}
+
+- (NSString *)internalRecordKeyForTransactionIdentifier:(NSString *)transactionIdentifier user:(NSString *)userid {
+    return [NSString stringWithFormat:@"%@.record.%@.%@", kBLWalletModelsKeyChainStore, userid, transactionIdentifier];
+}
+
+- (NSString *)internalJournalKeyForUser:(NSString *)userid sequence:(uint64_t)sequence {
+    return [NSString stringWithFormat:@"%@.journal.%@.%llu", kBLWalletModelsKeyChainStore, userid, sequence];
+}
+
+- (NSString *)internalQuarantinedJournalKeyForUser:(NSString *)userid sequence:(uint64_t)sequence {
+    return [NSString stringWithFormat:@"%@.quarantine.%@.%llu", kBLWalletModelsKeyChainStore, userid, sequence];
+}
+
+- (BOOL)internalWriteRecordForModel:(BLPaymentTransactionModel *)model
+                    recordChecksums:(NSMutableDictionary<NSString *, NSNumber *> *)recordChecksums
+                            forUser:(NSString *)userid {
+    NSData *data = [model encodedData];
+    if (!data) {
+        return NO;
+    }
+    
+    recordChecksums[model.transactionIdentifier] = @(BLWalletChecksum(data.bytes, data.length));
+    
+    // 对已存在的条目执行原地更新.
+    return [self.backend setData:data forKey:[self internalRecordKeyForTransactionIdentifier:model.transactionIdentifier user:userid]];
+}
+
+- (BOOL)internalWriteIndexForModels:(NSArray<BLPaymentTransactionModel *> *)models
+                    recordChecksums:(NSDictionary<NSString *, NSNumber *> *)recordChecksums
+                 checkpointSequence:(uint64_t)checkpointSequence
+         previousCheckpointSequence:(uint64_t)previousCheckpointSequence
+                            forUser:(NSString *)userid {
+    NSDictionary *index = @{
+                            @"transactionIdentifiers" : [models valueForKey:@"transactionIdentifier"] ?: @[],
+                            @"recordChecksums" : recordChecksums.copy ?: @{},
+                            @"checkpointSequence" : @(checkpointSequence),
+                            @"previousCheckpointSequence" : @(previousCheckpointSequence)
+                            };
+    return [self.backend setData:[NSKeyedArchiver archivedDataWithRootObject:index] forKey:[self internalIndexKeyForUser:userid]];
+}
+
+// 将旧版本 dict - set - model 的全局存储拆分到每个用户自己的 keychain 条目中.
+- (void)internalMigrateLegacyStoreIfNeed {
+    if (self.legacyStoreMigrated) {
+        return;
+    }
+    self.legacyStoreMigrated = YES;
+    
+    NSData *dictData = [self.backend dataForKey:kBLWalletModelsKeyChainStore];
+    if (!dictData.length) {
+        return;
+    }
+    
+    NSDictionary<NSString *, NSData *> *dict = [NSKeyedUnarchiver unarchiveObjectWithData:dictData];
+    __block BOOL success = YES;
+    [dict enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull userid, NSData * _Nonnull setData, BOOL * _Nonnull stop) {
+        
+        if (![setData isKindOfClass:[NSData class]] || !setData.length) {
+            return;
+        }
+        success = [self.backend setData:setData forKey:[self internalSetKeyForUser:userid]] && success;
+        
+    }];
+    
+    // 所有用户都迁移成功以后才删除旧数据, 迁移中途失败下次启动会重新迁移.
+    if (success) {
+        [self.backend removeItemForKey:kBLWalletModelsKeyChainStore];
+    }
+    else {
+        NSLog(@"迁移旧版本 keychain 数据失败");
+    }
+}
+
+// 将某个用户 set - model 的存储拆分为每笔交易一个 keychain 条目.
+- (void)internalMigrateUserStoreIfNeed:(NSString *)userid {
+    NSString *setKey = [self internalSetKeyForUser:userid];
+    NSData *setData = [self.backend dataForKey:setKey];
+    if (!setData.length) {
+        return;
+    }
+    
+    // 已经有索引说明上次迁移成功, 只是旧数据没删掉. 不能再迁移一次, 否则会用旧数据和 checkpoint 0 覆盖之后的修改.
+    if ([self.backend dataForKey:[self internalIndexKeyForUser:userid]].length) {
+        [self.backend removeItemForKey:setKey];
+        return;
+    }
+    
+    NSSet<NSData *> *modelsData = [NSKeyedUnarchiver unarchiveObjectWithData:setData];
+    NSMutableArray<BLPaymentTransactionModel *> *modelsM = [NSMutableArray arrayWithCapacity:modelsData.count];
+    NSMutableSet<NSString *> *transactionIdentifiers = [NSMutableSet setWithCapacity:modelsData.count];
+    NSMutableDictionary<NSString *, NSNumber *> *recordChecksums = [NSMutableDictionary dictionaryWithCapacity:modelsData.count];
+    BOOL success = YES;
+    for (NSData *data in modelsData) {
+        NSParameterAssert([data isKindOfClass:[NSData class]]);
+        BLPaymentTransactionModel *model = [[BLPaymentTransactionModel alloc] initWithEncodedData:data];
+        if (!model || [transactionIdentifiers containsObject:model.transactionIdentifier]) {
+            continue;
+        }
+        [transactionIdentifiers addObject:model.transactionIdentifier];
+        [modelsM addObject:model];
+        success = [self internalWriteRecordForModel:model recordChecksums:recordChecksums forUser:userid] && success;
+    }
+    
+    // 记录和索引都写入成功以后才删除旧数据.
+    success = success && [self internalWriteIndexForModels:modelsM recordChecksums:recordChecksums checkpointSequence:0 previousCheckpointSequence:0 forUser:userid];
+    if (success) {
+        [self.backend removeItemForKey:setKey];
+    }
+    else {
+        NSLog(@"%@", [NSString stringWithFormat:@"迁移 userID 为 %@ 的 keychain 数据失败", userid]);
+    }
+}
+
+
+#pragma mark - Check
+
+// 回读刚写入的日志, 只对比头部的 generation 和校验和, 不需要解码.
+- (BOOL)internalConfirmJournalData:(NSData *)data forKey:(NSString *)key {
+    NSData *writtenData = [self.backend dataForKey:key];
+    // 和写入 keychain 相比, 完整对比的代价可以忽略, 头部相同但是操作数据损坏的写入也能发现.
+    if (![writtenData isEqualToData:data]) {
+        NSLog(@"%@", [NSString stringWithFormat:@"keychain 日志写入校验失败, key: %@", key]);
+        return NO;
+    }
+    return YES;
+}
+
+// 完整的回读检查代价很高(重新加载整个用户的数据), DEBUG 下每次都做, release 下抽样.
+- (BOOL)internalShouldRunFullAudit {
+#if DEBUG
+    return YES;
+#else
+    return arc4random_uniform(kBLWalletFullAuditSampleRate) == 0;
+#endif
+}
+
+// 存储结果可靠性检查, 直接读取 keychain, 不经过缓存.
+- (void)internalCheckModelsSaveResult:(NSArray<BLPaymentTransactionModel *> *)models userid:(NSString *)userid {
+    uint64_t previousCheckpointSequence = 0;
+    pthread_mutex_lock(&_lock);
+    NSDictionary<NSString *, BLPaymentTransactionModel *> *modelsExisted = [self internalReadStateFromKeychainForUser:userid previousCheckpointSequence:&previousCheckpointSequence].modelsByTransactionIdentifier;
+    pthread_mutex_unlock(&_lock);
+    for (BLPaymentTransactionModel *model in models) {
+        BOOL contained = [modelsExisted[model.transactionIdentifier] isEqual:model];
+        if (!contained) {
+            // 报告错误.
+            NSLog(@"%@", [NSString stringWithFormat:@"存储模型到 keychain 存完以后, keychain 里没有 %@", model]);
+        }
+    }
+}
+
+
+- (void)internalCheckModelsDeleteResultWithTransactionIdentifier:(NSString *)transactionIdentifier userid:(NSString *)userid {
+    NSParameterAssert(transactionIdentifier);
+    if (!transactionIdentifier.length) {
+        return;
+    }
+    
+    uint64_t previousCheckpointSequence = 0;
+    pthread_mutex_lock(&_lock);
+    BOOL contained = [self internalReadStateFromKeychainForUser:userid previousCheckpointSequence:&previousCheckpointSequence].modelsByTransactionIdentifier[transactionIdentifier] != nil;
+    pthread_mutex_unlock(&_lock);
+    if (contained) {
+        // 报告错误.
+        NSLog(@"%@", [NSString stringWithFormat:@"删除 keychain 里的数据以后, keychain 还有这个数据 %@", transactionIdentifier]);
+    }
+}
+
+@end
@@ -0,0 +1,241 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "BLPaymentTransactionModel.h"
+
+/**
+ * 基准测试的模型数量.
+ */
+static const NSUInteger kBLCodecBenchmarkModelCounts[] = {1, 100, 10000};
+
+/**
+ * 紧凑二进制编码的测试, 以及和 NSKeyedArchiver 的耗时/体积对比.
+ */
+@interface BLPaymentTransactionModelCodecTests : XCTestCase
+
+@end
+
+@implementation BLPaymentTransactionModelCodecTests
+
+- (BLPaymentTransactionModel *)modelWithIndex:(NSUInteger)index {
+    BLPaymentTransactionModel *model = [[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.coin.6"
+                                                                              transactionIdentifier:[NSString stringWithFormat:@"10000003586%05lu", (unsigned long)index]
+                                                                                    transactionDate:[NSDate dateWithTimeIntervalSince1970:1513000000.25 + index]];
+    model.orderNo = [NSString stringWithFormat:@"201712180000%05lu", (unsigned long)index];
+    model.priceTagString = @"6";
+    model.md5 = @"0f7e4cbc2f4b4d0bd1fa2c4de1b2b7e5";
+    model.modelVerifyCount = index % 5;
+    model.isTransactionValidFromService = index % 2;
+    return model;
+}
+
+- (NSArray<BLPaymentTransactionModel *> *)modelsWithCount:(NSUInteger)count {
+    NSMutableArray<BLPaymentTransactionModel *> *models = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [models addObject:[self modelWithIndex:i]];
+    }
+    return [models copy];
+}
+
+- (void)assertModel:(BLPaymentTransactionModel *)model equalToModel:(BLPaymentTransactionModel *)expectedModel {
+    XCTAssertNotNil(model);
+    XCTAssertEqualObjects(model.transactionIdentifier, expectedModel.transactionIdentifier);
+    XCTAssertEqualObjects(model.productIdentifier, expectedModel.productIdentifier);
+    XCTAssertEqualObjects(model.transactionDate, expectedModel.transactionDate);
+    XCTAssertEqualObjects(model.orderNo, expectedModel.orderNo);
+    XCTAssertEqualObjects(model.priceTagString, expectedModel.priceTagString);
+    XCTAssertEqualObjects(model.md5, expectedModel.md5);
+    XCTAssertEqual(model.modelVerifyCount, expectedModel.modelVerifyCount);
+    XCTAssertEqual(model.isTransactionValidFromService, expectedModel.isTransactionValidFromService);
+}
+
+/**
+ * 访问所有字段, 让紧凑格式的延迟解码也计入耗时, 和 NSKeyedUnarchiver 的完整解码对齐.
+ */
+static NSUInteger BLCodecTouchAllFields(BLPaymentTransactionModel *model) {
+    return model.transactionIdentifier.length + model.productIdentifier.length + model.orderNo.length
+    + model.priceTagString.length + model.md5.length + model.modelVerifyCount + model.isTransactionValidFromService
+    + (NSUInteger)model.transactionDate.timeIntervalSince1970;
+}
+
+
+#pragma mark - Codec
+
+- (void)testRoundTrip {
+    BLPaymentTransactionModel *model = [self modelWithIndex:7];
+    [self assertModel:[[BLPaymentTransactionModel alloc] initWithEncodedData:[model encodedData]] equalToModel:model];
+    
+    // 可选字段为空, 以及非 ASCII 字符.
+    BLPaymentTransactionModel *emptyModel = [[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.金币"
+                                                                                   transactionIdentifier:@"1000000358600000"
+                                                                                         transactionDate:[NSDate dateWithTimeIntervalSince1970:0]];
+    BLPaymentTransactionModel *decodedModel = [[BLPaymentTransactionModel alloc] initWithEncodedData:[emptyModel encodedData]];
+    [self assertModel:decodedModel equalToModel:emptyModel];
+    XCTAssertNil(decodedModel.orderNo);
+    XCTAssertNil(decodedModel.priceTagString);
+    XCTAssertNil(decodedModel.md5);
+}
+
+- (void)testReEncodingLazyModelKeepsData {
+    BLPaymentTransactionModel *model = [self modelWithIndex:3];
+    BLPaymentTransactionModel *decodedModel = [[BLPaymentTransactionModel alloc] initWithEncodedData:[model encodedData]];
+    
+    // 没有访问过延迟字段就再次编码.
+    XCTAssertEqualObjects([decodedModel encodedData], [model encodedData]);
+}
+
+- (void)testLegacyArchiveIsDecoded {
+    BLPaymentTransactionModel *model = [self modelWithIndex:1];
+    NSData *legacyData = [NSKeyedArchiver archivedDataWithRootObject:model];
+    [self assertModel:[[BLPaymentTransactionModel alloc] initWithEncodedData:legacyData] equalToModel:model];
+}
+
+- (void)testTruncatedDataReturnsNil {
+    NSData *data = [[self modelWithIndex:9] encodedData];
+    
+    // 前两个字节是 magic, 更短的数据会被当成旧版本归档处理.
+    for (NSUInteger length = 2; length < data.length; length++) {
+        XCTAssertNil([[BLPaymentTransactionModel alloc] initWithEncodedData:[data subdataWithRange:NSMakeRange(0, length)]], @"length %@", @(length));
+    }
+}
+
+- (void)testOverlongStringFailsEncoding {
+    BLPaymentTransactionModel *model = [self modelWithIndex:5];
+    
+    // 长度前缀是 2 字节, 0xFFFF 表示 nil. 65535 字节的字符串不截断, 直接编码失败, 多字节字符截断以后会变成无效的 UTF-8.
+    model.priceTagString = [@"" stringByPaddingToLength:0xFFFF / 3 withString:@"元" startingAtIndex:0];
+    XCTAssertNil([model encodedData]);
+    
+    model.priceTagString = [@"" stringByPaddingToLength:0xFFFF / 3 - 1 withString:@"元" startingAtIndex:0];
+    [self assertModel:[[BLPaymentTransactionModel alloc] initWithEncodedData:[model encodedData]] equalToModel:model];
+}
+
+- (void)testCompactDataIsSmallerThanArchive {
+    BLPaymentTransactionModel *model = [self modelWithIndex:0];
+    XCTAssertLessThan([model encodedData].length, [NSKeyedArchiver archivedDataWithRootObject:model].length);
+}
+
+
+#pragma mark - Benchmark
+
+/**
+ * 1 / 100 / 10000 个模型分别用两种格式编码和解码, 每种取 5 次中最快的一次, 结果输出到测试日志.
+ */
+- (void)testCodecComparison {
+    for (size_t i = 0; i < sizeof(kBLCodecBenchmarkModelCounts) / sizeof(kBLCodecBenchmarkModelCounts[0]); i++) {
+        NSUInteger count = kBLCodecBenchmarkModelCounts[i];
+        NSArray<BLPaymentTransactionModel *> *models = [self modelsWithCount:count];
+        
+        __block NSArray<NSData *> *compactDatas = nil;
+        __block NSArray<NSData *> *archivedDatas = nil;
+        CFTimeInterval compactEncodeTime = [self bestTimeOfBlock:^{
+            compactDatas = [self compactDatasWithModels:models];
+        }];
+        CFTimeInterval archiveEncodeTime = [self bestTimeOfBlock:^{
+            archivedDatas = [self archivedDatasWithModels:models];
+        }];
+        CFTimeInterval compactDecodeTime = [self bestTimeOfBlock:^{
+            [self decodeCompactDatas:compactDatas];
+        }];
+        CFTimeInterval archiveDecodeTime = [self bestTimeOfBlock:^{
+            [self decodeArchivedDatas:archivedDatas];
+        }];
+        
+        NSUInteger compactBytes = [[compactDatas valueForKeyPath:@"@sum.length"] unsignedIntegerValue];
+        NSUInteger archivedBytes = [[archivedDatas valueForKeyPath:@"@sum.length"] unsignedIntegerValue];
+        NSLog(@"[BLIAP codec] %5lu models | compact: encode %8.3f ms, decode %8.3f ms, %8lu bytes | NSKeyedArchiver: encode %8.3f ms, decode %8.3f ms, %8lu bytes",
+              (unsigned long)count,
+              compactEncodeTime * 1000, compactDecodeTime * 1000, (unsigned long)compactBytes,
+              archiveEncodeTime * 1000, archiveDecodeTime * 1000, (unsigned long)archivedBytes);
+        XCTAssertLessThan(compactBytes, archivedBytes);
+    }
+}
+
+- (void)testCompactEncodePerformance {
+    NSArray<BLPaymentTransactionModel *> *models = [self modelsWithCount:10000];
+    [self measureBlock:^{
+        [self compactDatasWithModels:models];
+    }];
+}
+
+- (void)testArchiveEncodePerformance {
+    NSArray<BLPaymentTransactionModel *> *models = [self modelsWithCount:10000];
+    [self measureBlock:^{
+        [self archivedDatasWithModels:models];
+    }];
+}
+
+- (void)testCompactDecodePerformance {
+    NSArray<NSData *> *datas = [self compactDatasWithModels:[self modelsWithCount:10000]];
+    [self measureBlock:^{
+        [self decodeCompactDatas:datas];
+    }];
+}
+
+- (void)testArchiveDecodePerformance {
+    NSArray<NSData *> *datas = [self archivedDatasWithModels:[self modelsWithCount:10000]];
+    [self measureBlock:^{
+        [self decodeArchivedDatas:datas];
+    }];
+}
+
+
+#pragma mark - Private
+
+- (CFTimeInterval)bestTimeOfBlock:(void(NS_NOESCAPE ^)(void))block {
+    CFTimeInterval bestTime = DBL_MAX;
+    for (NSUInteger i = 0; i < 5; i++) {
+        @autoreleasepool {
+            
+            CFTimeInterval startTime = CACurrentMediaTime();
+            block();
+            bestTime = MIN(bestTime, CACurrentMediaTime() - startTime);
+            
+        }
+    }
+    return bestTime;
+}
+
+- (NSArray<NSData *> *)compactDatasWithModels:(NSArray<BLPaymentTransactionModel *> *)models {
+    NSMutableArray<NSData *> *datas = [NSMutableArray arrayWithCapacity:models.count];
+    for (BLPaymentTransactionModel *model in models) {
+        [datas addObject:[model encodedData]];
+    }
+    return datas;
+}
+
+- (NSArray<NSData *> *)archivedDatasWithModels:(NSArray<BLPaymentTransactionModel *> *)models {
+    NSMutableArray<NSData *> *datas = [NSMutableArray arrayWithCapacity:models.count];
+    for (BLPaymentTransactionModel *model in models) {
+        [datas addObject:[NSKeyedArchiver archivedDataWithRootObject:model]];
+    }
+    return datas;
+}
+
+- (void)decodeCompactDatas:(NSArray<NSData *> *)datas {
+    NSUInteger checksum = 0;
+    for (NSData *data in datas) {
+        checksum += BLCodecTouchAllFields([[BLPaymentTransactionModel alloc] initWithEncodedData:data]);
+    }
+    XCTAssertGreaterThan(checksum, 0);
+}
+
+- (void)decodeArchivedDatas:(NSArray<NSData *> *)datas {
+    NSUInteger checksum = 0;
+    for (NSData *data in datas) {
+        checksum += BLCodecTouchAllFields([NSKeyedUnarchiver unarchiveObjectWithData:data]);
+    }
+    XCTAssertGreaterThan(checksum, 0);
+}
+
+@end
@@ -0,0 +1,142 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import <NSData+MD5Digest.h>
+#import "BLPaymentTransactionReceipt.h"
+#import "BLPaymentVerifyTestSupport.h"
+
+// 同一个版本的收据上等待验证的 task 数量.
+static const NSUInteger kBLReceiptBenchmarkTaskCount = 20;
+
+/**
+ * 以前每个 task 自己编码收据时创建的对象, 用来和共享收据对比.
+ */
+@interface BLLegacyReceiptEncoding : NSObject
+
+@property(nonatomic, copy) NSString *base64EncodedString;
+
+@property(nonatomic, strong) NSData *utf8Data;
+
+@property(nonatomic, copy) NSString *md5;
+
+@end
+
+@implementation BLLegacyReceiptEncoding
+
+/**
+ * 和以前 `-start` 以及 `-sendUploadCertificateRequest` 里的代码一致: base64 字符串 -> UTF-8 数据 -> md5.
+ */
++ (instancetype)encodingWithReceiptData:(NSData *)receiptData {
+    BLLegacyReceiptEncoding *encoding = [BLLegacyReceiptEncoding new];
+    encoding.base64EncodedString = [receiptData base64EncodedStringWithOptions:NSDataBase64EncodingEndLineWithLineFeed];
+    encoding.utf8Data = [encoding.base64EncodedString dataUsingEncoding:NSUTF8StringEncoding];
+    encoding.md5 = [NSData MD5HexDigest:encoding.utf8Data];
+    return encoding;
+}
+
+/**
+ * 这次编码创建的缓冲区字节数: base64 字符串 + UTF-8 数据 + md5 字符串.
+ */
+- (NSUInteger)encodedByteCount {
+    return [self.base64EncodedString lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + self.utf8Data.length + [self.md5 lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+}
+
+@end
+
+/**
+ * 共享收据和以前每个 task 各自编码的对比, 收据使用项目里附带的 receipt.txt.
+ */
+@interface BLPaymentTransactionReceiptTests : XCTestCase
+
+@property(nonatomic, strong) NSData *receiptData;
+
+@end
+
+@implementation BLPaymentTransactionReceiptTests
+
+- (void)setUp {
+    [super setUp];
+    
+    self.receiptData = [BLPaymentVerifyTestSupport bundledReceiptData];
+}
+
+- (void)testReceiptMatchesLegacyEncoding {
+    BLPaymentTransactionReceipt *receipt = [[BLPaymentTransactionReceipt alloc] initWithData:self.receiptData];
+    BLLegacyReceiptEncoding *encoding = [BLLegacyReceiptEncoding encodingWithReceiptData:self.receiptData];
+    
+    // 上传给后台的数据和以前完全一致.
+    XCTAssertEqualObjects(receipt.base64EncodedString, encoding.base64EncodedString);
+    XCTAssertEqualObjects(receipt.md5, encoding.md5);
+    XCTAssertTrue([receipt isEqualToData:[self.receiptData copy]]);
+}
+
+/**
+ * 同一个版本的收据上有 `kBLReceiptBenchmarkTaskCount` 个 task, 每个 task 开始和上传收据各编码一次.
+ * 统计两种方式创建的编码对象数量和字节数, 结果输出到测试日志.
+ *
+ * @warning 这里统计的是编码结果对象本身的大小, 不是 malloc 的总量.
+ */
+- (void)testAllocationComparison {
+    NSUInteger legacyObjectCount = 0;
+    NSUInteger legacyByteCount = 0;
+    for (NSUInteger i = 0; i < kBLReceiptBenchmarkTaskCount * 2; i++) {
+        @autoreleasepool {
+            
+            legacyObjectCount += 3;
+            legacyByteCount += [[BLLegacyReceiptEncoding encodingWithReceiptData:self.receiptData] encodedByteCount];
+            
+        }
+    }
+    
+    // 共享收据: 整个版本只编码一次, task 只持有引用.
+    BLPaymentTransactionReceipt *receipt = [[BLPaymentTransactionReceipt alloc] initWithData:self.receiptData];
+    NSUInteger sharedObjectCount = 3;
+    NSUInteger sharedByteCount = [receipt.base64EncodedString lengthOfBytesUsingEncoding:NSUTF8StringEncoding] * 2 + [receipt.md5 lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    
+    NSLog(@"[BLIAP receipt] %lu bytes receipt, %lu tasks | per-task encoding: %lu objects, %lu bytes | shared receipt: %lu objects, %lu bytes | saved %lu bytes",
+          (unsigned long)self.receiptData.length, (unsigned long)kBLReceiptBenchmarkTaskCount,
+          (unsigned long)legacyObjectCount, (unsigned long)legacyByteCount,
+          (unsigned long)sharedObjectCount, (unsigned long)sharedByteCount,
+          (unsigned long)(legacyByteCount - sharedByteCount));
+    XCTAssertEqual(legacyByteCount, sharedByteCount * kBLReceiptBenchmarkTaskCount * 2);
+}
+
+- (void)testPerTaskEncodingPerformance {
+    NSData *receiptData = self.receiptData;
+    [self measureBlock:^{
+        
+        for (NSUInteger i = 0; i < kBLReceiptBenchmarkTaskCount * 2; i++) {
+            @autoreleasepool {
+                
+                [BLLegacyReceiptEncoding encodingWithReceiptData:receiptData];
+                
+            }
+        }
+        
+    }];
+}
+
+- (void)testSharedReceiptPerformance {
+    NSData *receiptData = self.receiptData;
+    [self measureBlock:^{
+        
+        BLPaymentTransactionReceipt *receipt = [[BLPaymentTransactionReceipt alloc] initWithData:receiptData];
+        for (NSUInteger i = 0; i < kBLReceiptBenchmarkTaskCount * 2; i++) {
+            // task 直接读取共享收据上已经算好的值.
+            (void)receipt.base64EncodedString;
+            (void)receipt.md5;
+        }
+        
+    }];
+}
+
+@end
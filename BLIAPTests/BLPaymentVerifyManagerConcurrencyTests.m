@@ -0,0 +1,124 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "BLPaymentVerifyTestSupport.h"
+
+// 每次验证的交易数量, 比如用户连续买了 8 个金币包.
+static const NSUInteger kBLConcurrencyTestTransactionCount = 8;
+// 模拟后台每个请求的延迟, 每笔交易是两个请求(创建订单, 上传收据).
+static const NSTimeInterval kBLConcurrencyTestLatency = 0.1;
+
+/**
+ * 并发验证的正确性, 以及并发数为 1 / 2 / 4 时验证完一批交易的耗时对比.
+ */
+@interface BLPaymentVerifyManagerConcurrencyTests : XCTestCase
+
+@property(nonatomic, strong) BLMockPaymentVerifyTransport *transport;
+
+@end
+
+@implementation BLPaymentVerifyManagerConcurrencyTests
+
+- (void)setUp {
+    [super setUp];
+    
+    self.transport = [[BLMockPaymentVerifyTransport alloc] initWithBaseURL:[NSURL URLWithString:@"http://127.0.0.1"]];
+    self.transport.latency = kBLConcurrencyTestLatency;
+    [self.transport install];
+}
+
+- (void)tearDown {
+    [self.transport uninstall];
+    self.transport = nil;
+    
+    [super tearDown];
+}
+
+/**
+ * 用指定的并发数验证完 `kBLConcurrencyTestTransactionCount` 笔交易, 返回从添加第一笔交易到收到最后一个结果的耗时.
+ */
+- (CFTimeInterval)drainWithMaxConcurrentVerifyTaskCount:(NSUInteger)maxConcurrentVerifyTaskCount {
+    BLPaymentVerifyManager *manager = [BLPaymentVerifyTestSupport managerWithMemoryStore];
+    BLPaymentVerifyTestDelegate *delegate = [BLPaymentVerifyTestDelegate new];
+    manager.delegate = delegate;
+    manager.maxConcurrentVerifyTaskCount = maxConcurrentVerifyTaskCount;
+    
+    // 先加载任务队列, 加载的耗时不计入验证耗时.
+    [manager refreshTransactionReceiptData:[BLPaymentVerifyTestSupport bundledReceiptData]];
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    
+    NSString *prefix = [NSString stringWithFormat:@"concurrency.%@", @(maxConcurrentVerifyTaskCount)];
+    NSArray<BLPaymentTransactionModel *> *models = [BLPaymentVerifyTestSupport transactionModelsWithCount:kBLConcurrencyTestTransactionCount prefix:prefix];
+    XCTestExpectation *expectation = [self expectationWithDescription:prefix];
+    __block CFTimeInterval endTime = 0;
+    delegate.expectedValidCount = models.count;
+    delegate.completion = ^{
+        
+        endTime = CACurrentMediaTime();
+        [expectation fulfill];
+        
+    };
+    
+    CFTimeInterval startTime = CACurrentMediaTime();
+    for (BLPaymentTransactionModel *model in models) {
+        [manager appendPaymentTransactionModel:model];
+    }
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    
+    // 每笔交易都收到了一次结果, 并且都从存储里删除了.
+    XCTAssertEqualObjects([NSSet setWithArray:delegate.validTransactionIdentifiers], [NSSet setWithArray:[models valueForKey:@"transactionIdentifier"]]);
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    XCTAssertEqual(manager.transactionModelsInKeychain.count, 0);
+    XCTAssertEqual(manager.verifingTasks.count, 0);
+    
+    [manager cancelAllTasks];
+    return endTime - startTime;
+}
+
+- (void)testConcurrentVerificationKeepsPerTransactionOrdering {
+    [self drainWithMaxConcurrentVerifyTaskCount:4];
+    
+    XCTAssertEqual(self.transport.requestCount, kBLConcurrencyTestTransactionCount * 2);
+    XCTAssertLessThanOrEqual(self.transport.maxInFlightRequestCount, 4);
+    XCTAssertGreaterThan(self.transport.maxInFlightRequestCount, 1);
+    XCTAssertEqualObjects(self.transport.orderingViolations, @[]);
+}
+
+- (void)testSerialVerificationNeverOverlaps {
+    [self drainWithMaxConcurrentVerifyTaskCount:1];
+    
+    XCTAssertEqual(self.transport.maxInFlightRequestCount, 1);
+    XCTAssertEqualObjects(self.transport.orderingViolations, @[]);
+}
+
+/**
+ * 并发数为 1 / 2 / 4 时验证完同一批交易的耗时, 结果输出到测试日志.
+ *
+ * 每笔交易两个请求, 理论耗时约为 交易数 * 2 * 延迟 / 并发数.
+ */
+- (void)testLatencyComparison {
+    NSUInteger counts[] = {1, 2, 4};
+    CFTimeInterval durations[3] = {0};
+    for (size_t i = 0; i < 3; i++) {
+        durations[i] = [self drainWithMaxConcurrentVerifyTaskCount:counts[i]];
+        NSLog(@"[BLIAP concurrency] maxConcurrentVerifyTaskCount %lu: %lu transactions, %.0f ms latency per request, drained in %.3f s (ideal %.3f s)",
+              (unsigned long)counts[i], (unsigned long)kBLConcurrencyTestTransactionCount, kBLConcurrencyTestLatency * 1000,
+              durations[i], kBLConcurrencyTestTransactionCount * 2 * kBLConcurrencyTestLatency / counts[i]);
+    }
+    
+    // 只断言趋势, 具体数值和模拟器负载有关.
+    XCTAssertLessThan(durations[1], durations[0]);
+    XCTAssertLessThan(durations[2], durations[1]);
+}
+
+@end
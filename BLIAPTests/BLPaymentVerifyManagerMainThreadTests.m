@@ -0,0 +1,186 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import <mach/mach.h>
+#import <sys/resource.h>
+#import "BLPaymentVerifyTestSupport.h"
+#import "BLPaymentTransactionModel.h"
+
+// 积压的交易数量, 比如长时间没有网络以后一次性验证.
+static const NSUInteger kBLMainThreadTestTransactionCount = 100;
+// 模拟后台每个请求的延迟.
+static const NSTimeInterval kBLMainThreadTestLatency = 0.005;
+// 模拟 keychain 每次写入的延迟.
+static const NSTimeInterval kBLMainThreadTestWriteLatency = 0.2;
+
+/**
+ * 线程的 CPU 时间(用户态 + 内核态), 单位为秒.
+ */
+static NSTimeInterval BLThreadCPUTime(thread_act_t thread) {
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.user_time.seconds + info.user_time.microseconds / 1e6 + info.system_time.seconds + info.system_time.microseconds / 1e6;
+}
+
+/**
+ * 进程所有线程的 CPU 时间, 单位为秒.
+ */
+static NSTimeInterval BLProcessCPUTime(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * 积压交易验证过程中主线程占用的时间.
+ */
+@interface BLPaymentVerifyManagerMainThreadTests : XCTestCase
+
+@property(nonatomic, strong) BLMockPaymentVerifyTransport *transport;
+
+@end
+
+@implementation BLPaymentVerifyManagerMainThreadTests
+
+- (void)setUp {
+    [super setUp];
+    
+    self.transport = [[BLMockPaymentVerifyTransport alloc] initWithBaseURL:[NSURL URLWithString:@"http://127.0.0.1"]];
+    self.transport.latency = kBLMainThreadTestLatency;
+    [self.transport install];
+    [BLPaymentVerifyTestSupport setSuccessAlertsSuppressed:YES];
+}
+
+- (void)tearDown {
+    [BLPaymentVerifyTestSupport setSuccessAlertsSuppressed:NO];
+    [self.transport uninstall];
+    self.transport = nil;
+    
+    [super tearDown];
+}
+
+/**
+ * 主线程添加 `kBLMainThreadTestTransactionCount` 笔交易并等待全部验证完成.
+ * 输出: 主线程调用接口的耗时, 主线程 CPU 时间, 整个进程的 CPU 时间, 以及主线程的占比.
+ *
+ * @warning 成功的弹窗没有弹出, 这里只统计状态机自己(解码, 调度, 持久化, 代理回调)占用的主线程时间.
+ */
+- (void)testMainThreadTimeDuringBacklogDrain {
+    XCTAssertTrue([NSThread isMainThread]);
+    BLPaymentVerifyManager *manager = [BLPaymentVerifyTestSupport managerWithMemoryStore];
+    BLPaymentVerifyTestDelegate *delegate = [BLPaymentVerifyTestDelegate new];
+    manager.delegate = delegate;
+    manager.maxConcurrentVerifyTaskCount = 4;
+    [manager refreshTransactionReceiptData:[BLPaymentVerifyTestSupport bundledReceiptData]];
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    
+    NSArray<BLPaymentTransactionModel *> *models = [BLPaymentVerifyTestSupport transactionModelsWithCount:kBLMainThreadTestTransactionCount prefix:@"backlog"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"backlog drained"];
+    delegate.expectedValidCount = models.count;
+    delegate.completion = ^{
+        
+        [expectation fulfill];
+        
+    };
+    
+    thread_act_t mainThread = mach_thread_self();
+    NSTimeInterval mainThreadStartTime = BLThreadCPUTime(mainThread);
+    NSTimeInterval processStartTime = BLProcessCPUTime();
+    CFTimeInterval startTime = CACurrentMediaTime();
+    for (BLPaymentTransactionModel *model in models) {
+        [manager appendPaymentTransactionModel:model];
+    }
+    CFTimeInterval appendDuration = CACurrentMediaTime() - startTime;
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    
+    CFTimeInterval wallDuration = CACurrentMediaTime() - startTime;
+    NSTimeInterval mainThreadDuration = BLThreadCPUTime(mainThread) - mainThreadStartTime;
+    NSTimeInterval processDuration = BLProcessCPUTime() - processStartTime;
+    mach_port_deallocate(mach_task_self(), mainThread);
+    
+    NSLog(@"[BLIAP main thread] %lu transactions drained in %.3f s | append calls on main: %.3f ms total, %.1f us each | main thread CPU %.3f ms of %.3f ms process CPU (%.1f%%)",
+          (unsigned long)models.count, wallDuration,
+          appendDuration * 1000, appendDuration * 1e6 / models.count,
+          mainThreadDuration * 1000, processDuration * 1000, processDuration > 0 ? mainThreadDuration * 100 / processDuration : 0);
+    
+    // 代理回调都在主线程, 状态机的工作都不在主线程.
+    XCTAssertEqual(delegate.offMainThreadCallbackCount, 0);
+    XCTAssertEqual(delegate.validTransactionIdentifiers.count, models.count);
+    XCTAssertLessThan(mainThreadDuration, processDuration / 2);
+    
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    XCTAssertEqual(manager.transactionModelsInKeychain.count, 0);
+    [manager cancelAllTasks];
+}
+
+/**
+ * 持久化队列正在进行很慢的写入时, 主线程调用所有公开的读取接口.
+ * 读取的是已经发布的快照, 不等待验证队列, 持久化队列和存储的锁.
+ */
+- (void)testPublicReadsDoNotWaitForSlowWrites {
+    XCTAssertTrue([NSThread isMainThread]);
+    BLSlowStorageBackend *backend = [BLSlowStorageBackend new];
+    BLPaymentVerifyManager *manager = [BLPaymentVerifyTestSupport managerWithStorageBackend:backend];
+    NSArray<BLPaymentTransactionModel *> *models = [BLPaymentVerifyTestSupport transactionModelsWithCount:6 prefix:@"slow"];
+    
+    // 先写入一笔交易, 快照已经加载, 之后的读取不需要从存储加载.
+    [manager appendPaymentTransactionModel:models.firstObject];
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    
+    backend.writeLatency = kBLMainThreadTestWriteLatency;
+    for (BLPaymentTransactionModel *model in [models subarrayWithRange:NSMakeRange(1, models.count - 1)]) {
+        [manager appendPaymentTransactionModel:model];
+    }
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (!backend.isWriting && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.001];
+    }
+    XCTAssertTrue(backend.isWriting);
+    
+    CFTimeInterval startTime = CACurrentMediaTime();
+    NSArray<BLPaymentTransactionModel *> *storedModels = manager.transactionModelsInKeychain;
+    BOOL stored = [manager transactionDidStoreInKeyChainWithTransactionIdentifier:models.firstObject.transactionIdentifier];
+    BOOL cleared = [manager didNeedVerifyQueueClearedForCurrentUser];
+    NSArray<BLPaymentVerifyTask *> *verifingTasks = manager.verifingTasks;
+    BLPaymentVerifyTask *currentVerifingTask = manager.currentVerifingTask;
+    NSUInteger savedVerifyRequestCount = manager.savedVerifyRequestCount;
+    NSUInteger maxConcurrentVerifyTaskCount = manager.maxConcurrentVerifyTaskCount;
+    BOOL batchVerifyEnabled = manager.batchVerifyEnabled;
+    BLPaymentVerifyRetryPolicy *retryPolicy = manager.retryPolicy;
+    CFTimeInterval readDuration = CACurrentMediaTime() - startTime;
+    
+    NSLog(@"[BLIAP main thread] public reads during a %.0f ms keychain write: %.3f ms | models: %lu, verifing: %lu, current: %@, saved: %lu, lanes: %lu, batch: %@, policy: %@",
+          kBLMainThreadTestWriteLatency * 1000, readDuration * 1000,
+          (unsigned long)storedModels.count, (unsigned long)verifingTasks.count, currentVerifingTask, (unsigned long)savedVerifyRequestCount,
+          (unsigned long)maxConcurrentVerifyTaskCount, batchVerifyEnabled ? @"YES" : @"NO", retryPolicy);
+    
+    // 写入还没有完成, 读到的是写入之前的快照.
+    XCTAssertTrue(backend.isWriting);
+    XCTAssertLessThan(readDuration, kBLMainThreadTestWriteLatency / 2);
+    XCTAssertTrue(stored);
+    XCTAssertFalse(cleared);
+    XCTAssertGreaterThan(storedModels.count, 0);
+    XCTAssertLessThan(storedModels.count, models.count);
+    
+    backend.writeLatency = 0;
+    [BLPaymentVerifyTestSupport waitUntilManagerIdle:manager];
+    XCTAssertEqual(manager.transactionModelsInKeychain.count, models.count);
+    [manager cancelAllTasks];
+}
+
+@end
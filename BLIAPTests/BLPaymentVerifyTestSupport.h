@@ -0,0 +1,137 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <Foundation/Foundation.h>
+#import "BLPaymentVerifyManager.h"
+#import "BLPaymentVerifyTransport.h"
+#import "BLWalletStorageBackend.h"
+
+@class BLPaymentTransactionModel;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * 模拟的验证后台, 不发出网络请求, 固定延迟以后在调用方指定的队列返回成功.
+ *
+ * 创建订单返回 {orderNo, priceTagString, md5}, 上传收据返回 {status: 1}.
+ */
+@interface BLMockPaymentVerifyTransport : BLPaymentVerifyTransport
+
+/**
+ * 每个请求的响应延迟, 单位为秒.
+ */
+@property(nonatomic, assign) NSTimeInterval latency;
+
+/**
+ * 收到的请求数量(累计).
+ */
+@property(atomic, assign, readonly) NSUInteger requestCount;
+
+/**
+ * 同一时间在请求中的最大数量.
+ */
+@property(atomic, assign, readonly) NSUInteger maxInFlightRequestCount;
+
+/**
+ * 同一笔交易同时有两个请求在进行, 或者没有创建订单就上传收据的交易.
+ */
+@property(atomic, copy, readonly) NSArray<NSString *> *orderingViolations;
+
+/**
+ * 替换 `+[BLPaymentVerifyTransport sharedTransport]`, 之后所有验证请求都发到当前实例.
+ */
+- (void)install;
+
+/**
+ * 恢复原来的 `+[BLPaymentVerifyTransport sharedTransport]`.
+ */
+- (void)uninstall;
+
+@end
+
+/**
+ * 测试用的代理, 记录收到的验证结果.
+ */
+@interface BLPaymentVerifyTestDelegate : NSObject<BLPaymentVerifyManagerDelegate>
+
+/**
+ * 收到`收据有效`回调的交易, 按回调顺序排列.
+ */
+@property(nonatomic, strong, readonly) NSMutableArray<NSString *> *validTransactionIdentifiers;
+
+/**
+ * 收到的`收据有效`回调达到这个数量时执行 `completion`.
+ */
+@property(nonatomic, assign) NSUInteger expectedValidCount;
+
+@property(nonatomic, copy, nullable) dispatch_block_t completion;
+
+/**
+ * 不在主线程执行的代理回调数量.
+ */
+@property(atomic, assign, readonly) NSUInteger offMainThreadCallbackCount;
+
+@end
+
+/**
+ * 写入很慢的内存存储, 模拟 keychain 写入卡顿.
+ */
+@interface BLSlowStorageBackend : BLWalletMemoryStorageBackend
+
+/**
+ * 每次写入的延迟, 单位为秒. 默认为 0.
+ */
+@property(atomic, assign) NSTimeInterval writeLatency;
+
+/**
+ * 是否有写入正在进行.
+ */
+@property(atomic, assign, readonly, getter=isWriting) BOOL writing;
+
+@end
+
+@interface BLPaymentVerifyTestSupport : NSObject
+
+/**
+ * 项目里附带的收据 receipt.txt(base64 文本)解码以后的数据.
+ */
++ (NSData *)bundledReceiptData;
+
+/**
+ * 指定数量的交易模型, transactionIdentifier 以 `prefix` 开头.
+ */
++ (NSArray<BLPaymentTransactionModel *> *)transactionModelsWithCount:(NSUInteger)count prefix:(NSString *)prefix;
+
+/**
+ * 新建一个验证 manager: 使用新的用户 id, 交易存储换成内存存储, 网络状态固定为 WiFi.
+ */
++ (BLPaymentVerifyManager *)managerWithMemoryStore;
+
+/**
+ * 新建一个验证 manager: 使用新的用户 id, 交易存储换成指定的存储介质, 网络状态固定为 WiFi.
+ */
++ (BLPaymentVerifyManager *)managerWithStorageBackend:(id<BLWalletStorageBackend>)backend;
+
+/**
+ * 验证成功时 manager 会弹出 UIAlertView. 度量主线程耗时的时候不弹出, 只统计状态机自己占用的主线程时间.
+ *
+ * @param suppressed 是否不弹出.
+ */
++ (void)setSuccessAlertsSuppressed:(BOOL)suppressed;
+
+/**
+ * 阻塞当前线程, 直到 manager 之前提交的操作, 持久化以及持久化之后回到验证队列的操作都执行完.
+ */
++ (void)waitUntilManagerIdle:(BLPaymentVerifyManager *)manager;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,275 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import "BLPaymentVerifyTestSupport.h"
+#import "BLPaymentTransactionModel.h"
+#import "BLWalletKeyChainStore.h"
+#import "BLWalletCompat.h"
+#import <AFNetworkReachabilityManager.h>
+#import <UIKit/UIKit.h>
+#import <objc/runtime.h>
+
+/**
+ * 测试需要替换的 manager 私有属性.
+ */
+@interface BLPaymentVerifyManager (BLIAPTests)
+
+@property(nonatomic, strong, nonnull) BLWalletKeyChainStore *keychainStore;
+
+@property(nonatomic, strong, nonnull) AFNetworkReachabilityManager *networkReachabilityManager;
+
+@property(nonatomic, strong, readonly) dispatch_queue_t managerQueue;
+
+@end
+
+/**
+ * 网络状态固定为 WiFi, 测试结果不受模拟器网络的影响.
+ */
+@interface BLReachableNetworkReachabilityManager : AFNetworkReachabilityManager
+
+@end
+
+@implementation BLReachableNetworkReachabilityManager
+
+- (AFNetworkReachabilityStatus)networkReachabilityStatus {
+    return AFNetworkReachabilityStatusReachableViaWiFi;
+}
+
+@end
+
+@interface BLMockPaymentVerifyTransport()
+
+@property(atomic, assign, readwrite) NSUInteger requestCount;
+
+@property(atomic, assign, readwrite) NSUInteger maxInFlightRequestCount;
+
+/**
+ * 以下状态都只在 lock 内读写.
+ */
+@property(nonatomic, strong) NSLock *lock;
+
+@property(nonatomic, assign) NSUInteger inFlightRequestCount;
+
+@property(nonatomic, strong) NSMutableSet<NSString *> *inFlightTransactionIdentifiers;
+
+@property(nonatomic, strong) NSMutableSet<NSString *> *orderedTransactionIdentifiers;
+
+@property(nonatomic, strong) NSMutableArray<NSString *> *orderingViolationsM;
+
+@property(nonatomic, assign) IMP originalSharedTransportIMP;
+
+@end
+
+@implementation BLMockPaymentVerifyTransport
+
+- (instancetype)initWithBaseURL:(NSURL *)baseURL {
+    self = [super initWithBaseURL:baseURL];
+    if (self) {
+        _lock = [NSLock new];
+        _inFlightTransactionIdentifiers = [NSMutableSet set];
+        _orderedTransactionIdentifiers = [NSMutableSet set];
+        _orderingViolationsM = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)install {
+    NSAssert(!self.originalSharedTransportIMP, @"已经替换过了");
+    __weak typeof(self) wself = self;
+    Method method = class_getClassMethod([BLPaymentVerifyTransport class], @selector(sharedTransport));
+    self.originalSharedTransportIMP = method_setImplementation(method, imp_implementationWithBlock(^BLPaymentVerifyTransport *(id cls) {
+        
+        return wself;
+        
+    }));
+}
+
+- (void)uninstall {
+    if (!self.originalSharedTransportIMP) {
+        return;
+    }
+    
+    method_setImplementation(class_getClassMethod([BLPaymentVerifyTransport class], @selector(sharedTransport)), self.originalSharedTransportIMP);
+    self.originalSharedTransportIMP = NULL;
+}
+
+- (NSArray<NSString *> *)orderingViolations {
+    [self.lock lock];
+    NSArray<NSString *> *orderingViolations = [self.orderingViolationsM copy];
+    [self.lock unlock];
+    return orderingViolations;
+}
+
+- (NSURLSessionDataTask *)POST:(NSString *)path
+                    parameters:(NSDictionary *)parameters
+               timeoutInterval:(NSTimeInterval)timeoutInterval
+               completionQueue:(dispatch_queue_t)completionQueue
+                    completion:(BLPaymentVerifyTransportCompletion)completion {
+    NSString *transactionIdentifier = parameters[@"transactionIdentifier"];
+    BOOL isCreateOrder = [path isEqualToString:BLPaymentVerifyCreateOrderPath];
+    NSDictionary *data = isCreateOrder ? @{
+                                           @"orderNo" : [NSString stringWithFormat:@"order.%@", transactionIdentifier],
+                                           @"priceTagString" : @"6",
+                                           @"md5" : parameters[@"md5"] ?: @""
+                                           } : @{@"status" : @1};
+    
+    [self.lock lock];
+    self.requestCount++;
+    self.inFlightRequestCount++;
+    self.maxInFlightRequestCount = MAX(self.maxInFlightRequestCount, self.inFlightRequestCount);
+    if ([self.inFlightTransactionIdentifiers containsObject:transactionIdentifier]) {
+        [self.orderingViolationsM addObject:[NSString stringWithFormat:@"%@ 同时有两个请求", transactionIdentifier]];
+    }
+    if (!isCreateOrder && ![self.orderedTransactionIdentifiers containsObject:transactionIdentifier]) {
+        [self.orderingViolationsM addObject:[NSString stringWithFormat:@"%@ 没有创建订单就上传了收据", transactionIdentifier]];
+    }
+    [self.inFlightTransactionIdentifiers addObject:transactionIdentifier];
+    [self.lock unlock];
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.latency * NSEC_PER_SEC)), completionQueue ?: dispatch_get_main_queue(), ^{
+        
+        [self.lock lock];
+        self.inFlightRequestCount--;
+        [self.inFlightTransactionIdentifiers removeObject:transactionIdentifier];
+        if (isCreateOrder) {
+            [self.orderedTransactionIdentifiers addObject:transactionIdentifier];
+        }
+        [self.lock unlock];
+        completion(data, nil);
+        
+    });
+    return nil;
+}
+
+- (void)prewarmConnectionIfNeed {
+    // 模拟的后台不需要预热.
+}
+
+@end
+
+@interface BLPaymentVerifyTestDelegate()
+
+@property(atomic, assign, readwrite) NSUInteger offMainThreadCallbackCount;
+
+@end
+
+@implementation BLPaymentVerifyTestDelegate
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _validTransactionIdentifiers = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)paymentVerifyManager:(BLPaymentVerifyManager *)paymentVerifyManager paymentTransactionVerifyValid:(NSString *)transactionIdentifier {
+    [self recordCallbackThread];
+    [self.validTransactionIdentifiers addObject:transactionIdentifier];
+    if (self.validTransactionIdentifiers.count == self.expectedValidCount && self.completion) {
+        self.completion();
+    }
+}
+
+- (void)paymentVerifyManager:(BLPaymentVerifyManager *)paymentVerifyManager paymentTransactionVerifyInvalid:(NSString *)transactionIdentifier {
+    [self recordCallbackThread];
+}
+
+- (void)paymentVerifyManagerRequestFailed:(BLPaymentVerifyManager *)paymentVerifyManager {
+    [self recordCallbackThread];
+}
+
+- (void)recordCallbackThread {
+    if (![NSThread isMainThread]) {
+        self.offMainThreadCallbackCount++;
+    }
+}
+
+@end
+
+@interface BLSlowStorageBackend()
+
+@property(atomic, assign, readwrite, getter=isWriting) BOOL writing;
+
+@end
+
+@implementation BLSlowStorageBackend
+
+- (BOOL)setData:(NSData *)data forKey:(NSString *)key {
+    self.writing = YES;
+    NSTimeInterval writeLatency = self.writeLatency;
+    if (writeLatency > 0) {
+        [NSThread sleepForTimeInterval:writeLatency];
+    }
+    BOOL success = [super setData:data forKey:key];
+    self.writing = NO;
+    return success;
+}
+
+@end
+
+@implementation BLPaymentVerifyTestSupport
+
++ (NSData *)bundledReceiptData {
+    NSString *path = [[NSBundle mainBundle] pathForResource:@"receipt" ofType:@"txt"];
+    NSString *base64String = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:nil];
+    NSData *receiptData = [[NSData alloc] initWithBase64EncodedString:base64String ?: @"" options:NSDataBase64DecodingIgnoreUnknownCharacters];
+    NSAssert(receiptData.length, @"App 里没有找到 receipt.txt");
+    return receiptData ?: [NSData data];
+}
+
++ (NSArray<BLPaymentTransactionModel *> *)transactionModelsWithCount:(NSUInteger)count prefix:(NSString *)prefix {
+    NSMutableArray<BLPaymentTransactionModel *> *models = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [models addObject:[[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.coin.6"
+                                                                  transactionIdentifier:[NSString stringWithFormat:@"%@.%@", prefix, @(i)]
+                                                                        transactionDate:[NSDate dateWithTimeIntervalSince1970:1513000000 + i]]];
+    }
+    return [models copy];
+}
+
++ (BLPaymentVerifyManager *)managerWithMemoryStore {
+    return [self managerWithStorageBackend:[BLWalletMemoryStorageBackend new]];
+}
+
++ (BLPaymentVerifyManager *)managerWithStorageBackend:(id<BLWalletStorageBackend>)backend {
+    BLPaymentVerifyManager *manager = [[BLPaymentVerifyManager alloc] initWithUserID:[NSUUID UUID].UUIDString];
+    
+    // 刚初始化完, 验证队列还没有读写过存储, 这里替换不会和验证队列竞争. 初始化时的预加载持有的是原来的存储, 不受影响.
+    manager.keychainStore = [[BLWalletKeyChainStore alloc] initWithBackend:backend];
+    [manager.networkReachabilityManager stopMonitoring];
+    manager.networkReachabilityManager = [BLReachableNetworkReachabilityManager manager];
+    return manager;
+}
+
+static IMP _originalAlertShowIMP = NULL;
++ (void)setSuccessAlertsSuppressed:(BOOL)suppressed {
+    Method method = class_getInstanceMethod([UIAlertView class], @selector(show));
+    if (suppressed && !_originalAlertShowIMP) {
+        _originalAlertShowIMP = method_setImplementation(method, imp_implementationWithBlock(^(UIAlertView *alertView) {
+            
+            // 不弹出.
+            
+        }));
+    }
+    else if (!suppressed && _originalAlertShowIMP) {
+        method_setImplementation(method, _originalAlertShowIMP);
+        _originalAlertShowIMP = NULL;
+    }
+}
+
++ (void)waitUntilManagerIdle:(BLPaymentVerifyManager *)manager {
+    // 验证队列 -> 持久化队列 -> 验证队列, 持久化完成以后的回调也执行完.
+    [manager waitUntilAllPendingPersistenceFinished];
+    dispatch_sync(manager.managerQueue, ^{});
+}
+
+@end
@@ -0,0 +1,246 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import "BLWalletTransactionModelsStore.h"
+#import "BLWalletStorageBackend.h"
+#import "BLPaymentTransactionModel.h"
+
+// 并发写入的线程数, 每个线程只修改自己的交易.
+static const NSUInteger kBLWalletStressWriterCount = 4;
+// 每个写线程的修改次数, 超过合并阈值, 压测过程中会触发后台合并.
+static const NSUInteger kBLWalletStressUpdateCount = 40;
+// 并发读取的线程数.
+static const NSUInteger kBLWalletStressReaderCount = 4;
+// 每个读线程的读取次数.
+static const NSUInteger kBLWalletStressReadCount = 2000;
+
+/**
+ * BLWalletTransactionModelsStore 的多线程压力测试和读竞争基准, 默认使用内存存储, 子类换成文件存储.
+ */
+@interface BLWalletTransactionModelsStoreStressTests : XCTestCase
+
+@property(nonatomic, copy) NSString *userid;
+
+@property(nonatomic, strong) id<BLWalletStorageBackend> backend;
+
+@property(nonatomic, strong) BLWalletTransactionModelsStore *store;
+
+/**
+ * 后台线程发现的问题, 回到测试线程以后统一断言.
+ */
+@property(nonatomic, strong) NSMutableArray<NSString *> *failures;
+
+@end
+
+@implementation BLWalletTransactionModelsStoreStressTests
+
+- (void)setUp {
+    [super setUp];
+    
+    self.userid = [NSUUID UUID].UUIDString;
+    self.backend = [self makeBackend];
+    self.store = [[BLWalletTransactionModelsStore alloc] initWithBackend:self.backend];
+    self.failures = [NSMutableArray array];
+}
+
+- (void)tearDown {
+    self.store = nil;
+    self.backend = nil;
+    
+    [super tearDown];
+}
+
+- (id<BLWalletStorageBackend>)makeBackend {
+    return [BLWalletMemoryStorageBackend new];
+}
+
+- (NSString *)transactionIdentifierWithIndex:(NSUInteger)index {
+    return [NSString stringWithFormat:@"transaction.%@", @(index)];
+}
+
+- (NSArray<BLPaymentTransactionModel *> *)seedModels {
+    NSMutableArray<BLPaymentTransactionModel *> *models = [NSMutableArray arrayWithCapacity:kBLWalletStressWriterCount];
+    for (NSUInteger i = 0; i < kBLWalletStressWriterCount; i++) {
+        [models addObject:[[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.coin.6"
+                                                                  transactionIdentifier:[self transactionIdentifierWithIndex:i]
+                                                                        transactionDate:[NSDate dateWithTimeIntervalSince1970:1513000000 + i]]];
+    }
+    [self.store bl_savePaymentTransactionModels:models forUser:self.userid];
+    return [models copy];
+}
+
+- (void)recordFailure:(NSString *)failure {
+    @synchronized(self.failures) {
+        [self.failures addObject:failure];
+    }
+}
+
+- (void)performWritersWithUpdateCount:(NSUInteger)updateCount {
+    dispatch_apply(kBLWalletStressWriterCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t index) {
+        
+        NSString *transactionIdentifier = [self transactionIdentifierWithIndex:index];
+        for (NSUInteger count = 1; count <= updateCount; count++) {
+            [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:transactionIdentifier modelVerifyCount:count forUser:self.userid];
+        }
+        
+    });
+}
+
+/**
+ * 读线程每次读到的快照都必须完整: 交易不多不少, 验证次数不会倒退.
+ */
+- (void)performReadersWithReadCount:(NSUInteger)readCount checkSnapshots:(BOOL)checkSnapshots {
+    dispatch_apply(kBLWalletStressReaderCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t index) {
+        
+        NSMutableDictionary<NSString *, NSNumber *> *lastVerifyCounts = [NSMutableDictionary dictionary];
+        for (NSUInteger i = 0; i < readCount; i++) {
+            @autoreleasepool {
+                
+                if (index % 2) {
+                    NSString *transactionIdentifier = [self transactionIdentifierWithIndex:i % kBLWalletStressWriterCount];
+                    BLPaymentTransactionModel *model = [self.store bl_fetchPaymentTransactionModelWithTransactionIdentifier:transactionIdentifier forUser:self.userid];
+                    if (checkSnapshots && !model) {
+                        [self recordFailure:[NSString stringWithFormat:@"%@ missing", transactionIdentifier]];
+                    }
+                    continue;
+                }
+                
+                NSArray<BLPaymentTransactionModel *> *models = [self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
+                if (!checkSnapshots) {
+                    continue;
+                }
+                
+                if (models.count != kBLWalletStressWriterCount) {
+                    [self recordFailure:[NSString stringWithFormat:@"snapshot has %@ models", @(models.count)]];
+                    continue;
+                }
+                for (BLPaymentTransactionModel *model in models) {
+                    NSUInteger lastVerifyCount = lastVerifyCounts[model.transactionIdentifier].unsignedIntegerValue;
+                    if (model.modelVerifyCount < lastVerifyCount) {
+                        [self recordFailure:[NSString stringWithFormat:@"%@ went back from %@ to %@", model.transactionIdentifier, @(lastVerifyCount), @(model.modelVerifyCount)]];
+                    }
+                    lastVerifyCounts[model.transactionIdentifier] = @(model.modelVerifyCount);
+                }
+                
+            }
+        }
+        
+    });
+}
+
+- (void)performWritersWithUpdateCount:(NSUInteger)updateCount readersWithReadCount:(NSUInteger)readCount checkSnapshots:(BOOL)checkSnapshots {
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        [self performWritersWithUpdateCount:updateCount];
+    });
+    dispatch_group_async(group, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        [self performReadersWithReadCount:readCount checkSnapshots:checkSnapshots];
+    });
+    XCTAssertEqual(dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(60 * NSEC_PER_SEC))), 0L, @"读写线程没有在限定时间内结束, 可能死锁");
+}
+
+
+#pragma mark - Stress
+
+- (void)testConcurrentReadersSeeConsistentSnapshots {
+    NSArray<BLPaymentTransactionModel *> *models = [self seedModels];
+    
+    [self performWritersWithUpdateCount:kBLWalletStressUpdateCount readersWithReadCount:kBLWalletStressReadCount checkSnapshots:YES];
+    XCTAssertEqualObjects(self.failures, @[]);
+    
+    // 写线程全部结束以后, 当前实例和重新加载的实例都能看到每笔交易的最后一次修改.
+    BLWalletTransactionModelsStore *reloadedStore = [[BLWalletTransactionModelsStore alloc] initWithBackend:self.backend];
+    for (BLWalletTransactionModelsStore *store in @[self.store, reloadedStore]) {
+        NSArray<BLPaymentTransactionModel *> *fetchedModels = [store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
+        XCTAssertEqualObjects(fetchedModels, models);
+        for (BLPaymentTransactionModel *model in fetchedModels) {
+            XCTAssertEqual(model.modelVerifyCount, kBLWalletStressUpdateCount);
+        }
+    }
+}
+
+- (void)testConcurrentUsersDoNotInterfere {
+    NSUInteger userCount = 8;
+    NSString *useridPrefix = self.userid;
+    dispatch_apply(userCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t index) {
+        
+        NSString *userid = [NSString stringWithFormat:@"%@.%@", useridPrefix, @(index)];
+        BLPaymentTransactionModel *model = [[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.coin.6"
+                                                                                   transactionIdentifier:[self transactionIdentifierWithIndex:index]
+                                                                                         transactionDate:[NSDate dateWithTimeIntervalSince1970:1513000000]];
+        [self.store bl_savePaymentTransactionModels:@[model] forUser:userid];
+        for (NSUInteger count = 1; count <= index + 1; count++) {
+            [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:model.transactionIdentifier modelVerifyCount:count forUser:userid];
+        }
+        [self.store bl_fetchAllPaymentTransactionModelsForUser:userid error:nil];
+        
+    });
+    
+    BLWalletTransactionModelsStore *reloadedStore = [[BLWalletTransactionModelsStore alloc] initWithBackend:self.backend];
+    for (NSUInteger index = 0; index < userCount; index++) {
+        NSString *userid = [NSString stringWithFormat:@"%@.%@", useridPrefix, @(index)];
+        NSArray<BLPaymentTransactionModel *> *fetchedModels = [reloadedStore bl_fetchAllPaymentTransactionModelsForUser:userid error:nil];
+        XCTAssertEqual(fetchedModels.count, 1);
+        XCTAssertEqualObjects(fetchedModels.firstObject.transactionIdentifier, [self transactionIdentifierWithIndex:index]);
+        XCTAssertEqual(fetchedModels.firstObject.modelVerifyCount, index + 1);
+    }
+}
+
+
+#pragma mark - Benchmark
+
+/**
+ * 没有写线程时的读取耗时, 作为下面读写竞争基准的对照.
+ */
+- (void)testUncontendedReadPerformance {
+    [self seedModels];
+    [self measureBlock:^{
+        [self performReadersWithReadCount:kBLWalletStressReadCount checkSnapshots:NO];
+    }];
+}
+
+/**
+ * 读线程和写线程同时运行时的耗时. 读取不加锁, 和上面的对照相比, 多出来的主要是写线程本身的耗时.
+ */
+- (void)testContendedReadPerformance {
+    [self seedModels];
+    [self measureBlock:^{
+        [self performWritersWithUpdateCount:kBLWalletStressUpdateCount readersWithReadCount:kBLWalletStressReadCount checkSnapshots:NO];
+    }];
+}
+
+@end
+
+@interface BLWalletTransactionModelsStoreFileBackendStressTests : BLWalletTransactionModelsStoreStressTests
+
+/**
+ * 文件存储的目录, 每个测试单独一个.
+ */
+@property(nonatomic, strong) NSURL *directoryURL;
+
+@end
+
+@implementation BLWalletTransactionModelsStoreFileBackendStressTests
+
+- (id<BLWalletStorageBackend>)makeBackend {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BLIAPTests/%@", [NSUUID UUID].UUIDString]];
+    self.directoryURL = [NSURL fileURLWithPath:path isDirectory:YES];
+    return [[BLWalletFileStorageBackend alloc] initWithDirectoryURL:self.directoryURL];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    
+    [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+}
+
+@end
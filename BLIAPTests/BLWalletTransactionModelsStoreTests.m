@@ -0,0 +1,299 @@
+/*
+ * This file is part of the BLIAP package.
+ * (c) NewPan <13246884282@163.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ *
+ * Click https://github.com/newyjp
+ * or http://www.jianshu.com/users/e2f2d779c022/latest_articles to contact me.
+ */
+
+#import <XCTest/XCTest.h>
+#import "BLWalletTransactionModelsStore.h"
+#import "BLWalletStorageBackend.h"
+#import "BLPaymentTransactionModel.h"
+
+// 和 store 内部的 key 格式保持一致, 用来直接检查存储介质里的数据.
+static NSString *const kBLWalletTransactionModelsStoreTestsKeyPrefix = @"com.wallet.models.keychain.store.www";
+
+/**
+ * BLWalletTransactionModelsStore 的功能测试, 默认使用内存存储, 子类换成其他存储介质以后跑同样的测试.
+ */
+@interface BLWalletTransactionModelsStoreTests : XCTestCase
+
+@property(nonatomic, copy) NSString *userid;
+
+@property(nonatomic, strong) id<BLWalletStorageBackend> backend;
+
+@property(nonatomic, strong) BLWalletTransactionModelsStore *store;
+
+@end
+
+@implementation BLWalletTransactionModelsStoreTests
+
+- (void)setUp {
+    [super setUp];
+    
+    self.userid = [NSUUID UUID].UUIDString;
+    self.backend = [self makeBackend];
+    self.store = [[BLWalletTransactionModelsStore alloc] initWithBackend:self.backend];
+}
+
+- (void)tearDown {
+    self.store = nil;
+    self.backend = nil;
+    
+    [super tearDown];
+}
+
+- (id<BLWalletStorageBackend>)makeBackend {
+    return [BLWalletMemoryStorageBackend new];
+}
+
+- (BLPaymentTransactionModel *)modelWithIndex:(NSUInteger)index {
+    return [[BLPaymentTransactionModel alloc] initWithProductIdentifier:@"com.ibeiliao.wallet.coin.6"
+                                                  transactionIdentifier:[NSString stringWithFormat:@"transaction.%@", @(index)]
+                                                        transactionDate:[NSDate dateWithTimeIntervalSince1970:1513000000 + index]];
+}
+
+- (BLWalletTransactionModelsStore *)reloadedStore {
+    return [[BLWalletTransactionModelsStore alloc] initWithBackend:self.backend];
+}
+
+- (NSString *)journalKeyWithSequence:(uint64_t)sequence {
+    return [NSString stringWithFormat:@"%@.journal.%@.%llu", kBLWalletTransactionModelsStoreTestsKeyPrefix, self.userid, sequence];
+}
+
+// 合并在后台执行, 等索引写入以后再重新加载. 返回索引里的 checkpoint, 超时返回 0.
+- (uint64_t)waitForCheckpointSequence {
+    NSString *indexKey = [NSString stringWithFormat:@"%@.index.%@", kBLWalletTransactionModelsStoreTestsKeyPrefix, self.userid];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    uint64_t checkpointSequence = 0;
+    while (!checkpointSequence && [deadline timeIntervalSinceNow] > 0) {
+        NSData *indexData = [self.backend dataForKey:indexKey];
+        NSDictionary *index = indexData ? [NSKeyedUnarchiver unarchiveObjectWithData:indexData] : nil;
+        checkpointSequence = [index isKindOfClass:[NSDictionary class]] ? [index[@"checkpointSequence"] unsignedLongLongValue] : 0;
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    return checkpointSequence;
+}
+
+
+#pragma mark - Tests
+
+- (void)testSaveAndFetch {
+    NSArray<BLPaymentTransactionModel *> *models = @[[self modelWithIndex:0], [self modelWithIndex:1], [self modelWithIndex:2]];
+    [self.store bl_savePaymentTransactionModels:models forUser:self.userid];
+    
+    NSError *error = nil;
+    NSArray<BLPaymentTransactionModel *> *fetchedModels = [self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(fetchedModels, models);
+    XCTAssertEqualObjects([self.store bl_fetchPaymentTransactionModelWithTransactionIdentifier:models[1].transactionIdentifier forUser:self.userid], models[1]);
+    XCTAssertNil([self.store bl_fetchPaymentTransactionModelWithTransactionIdentifier:@"transaction.none" forUser:self.userid]);
+    
+    // 快照 + 日志回放以后和写入的数据一致.
+    XCTAssertEqualObjects([[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], models);
+}
+
+- (void)testFetchWithoutRecordsReportsError {
+    NSError *error = nil;
+    XCTAssertNil([self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void)testUpdatesArePersisted {
+    BLPaymentTransactionModel *model = [self modelWithIndex:0];
+    NSString *transactionIdentifier = model.transactionIdentifier;
+    [self.store bl_savePaymentTransactionModels:@[model] forUser:self.userid];
+    [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:transactionIdentifier modelVerifyCount:3 forUser:self.userid];
+    [self.store bl_savePaymentTransactionModelWithTransactionIdentifier:transactionIdentifier orderNo:@"order.0" priceTagString:@"6" md5:@"md5.0" forUser:self.userid];
+    [self.store bl_updatePaymentTransactionModelStateWithTransactionIdentifier:transactionIdentifier isTransactionValidFromService:YES forUser:self.userid];
+    
+    // 后台没有返回价格时, 订单号照样保存, 价格保留原来的.
+    [self.store bl_savePaymentTransactionModelWithTransactionIdentifier:transactionIdentifier orderNo:@"order.1" priceTagString:nil md5:@"md5.1" forUser:self.userid];
+    
+    for (BLWalletTransactionModelsStore *store in @[self.store, [self reloadedStore]]) {
+        BLPaymentTransactionModel *fetchedModel = [store bl_fetchPaymentTransactionModelWithTransactionIdentifier:transactionIdentifier forUser:self.userid];
+        XCTAssertEqual(fetchedModel.modelVerifyCount, 3);
+        XCTAssertEqualObjects(fetchedModel.orderNo, @"order.1");
+        XCTAssertEqualObjects(fetchedModel.priceTagString, @"6");
+        XCTAssertEqualObjects(fetchedModel.md5, @"md5.1");
+        XCTAssertTrue(fetchedModel.isTransactionValidFromService);
+        XCTAssertEqualObjects(fetchedModel.productIdentifier, model.productIdentifier);
+        XCTAssertEqualObjects(fetchedModel.transactionDate, model.transactionDate);
+    }
+}
+
+- (void)testDelete {
+    NSArray<BLPaymentTransactionModel *> *models = @[[self modelWithIndex:0], [self modelWithIndex:1]];
+    [self.store bl_savePaymentTransactionModels:models forUser:self.userid];
+    
+    XCTAssertTrue([self.store bl_deletePaymentTransactionModelWithTransactionIdentifier:models[0].transactionIdentifier forUser:self.userid]);
+    XCTAssertFalse([self.store bl_deletePaymentTransactionModelWithTransactionIdentifier:models[0].transactionIdentifier forUser:self.userid]);
+    XCTAssertEqualObjects([self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], @[models[1]]);
+    XCTAssertEqualObjects([[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], @[models[1]]);
+    
+    [self.store bl_deleteAllPaymentTransactionModelsIfNeedForUser:self.userid];
+    XCTAssertNil([self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil]);
+    XCTAssertNil([[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil]);
+}
+
+- (void)testBatchUpdatesAppendOneJournalEntry {
+    BLPaymentTransactionModel *model0 = [self modelWithIndex:0];
+    BLPaymentTransactionModel *model1 = [self modelWithIndex:1];
+    [self.store bl_performBatchUpdatesForUser:self.userid usingBlock:^(BLWalletTransactionModelsBatch *batch) {
+        
+        [batch savePaymentTransactionModel:model0];
+        [batch savePaymentTransactionModel:model1];
+        [batch updatePaymentModelVerifyCountWithTransactionIdentifier:model1.transactionIdentifier modelVerifyCount:2];
+        [batch deletePaymentTransactionModelWithTransactionIdentifier:model0.transactionIdentifier];
+        
+    }];
+    
+    XCTAssertNotNil([self.backend dataForKey:[self journalKeyWithSequence:1]]);
+    XCTAssertNil([self.backend dataForKey:[self journalKeyWithSequence:2]]);
+    
+    NSArray<BLPaymentTransactionModel *> *fetchedModels = [[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
+    XCTAssertEqualObjects(fetchedModels, @[model1]);
+    XCTAssertEqual(fetchedModels.firstObject.modelVerifyCount, 2);
+}
+
+- (void)testBatchWithMoreThan65535RecordsSurvivesReload {
+    BLPaymentTransactionModel *model = [self modelWithIndex:0];
+    [self.store bl_savePaymentTransactionModels:@[model] forUser:self.userid];
+    
+    // 一条日志里的操作条数超过 2 字节能表示的范围, 重新加载时不能只回放溢出以后的几条.
+    NSUInteger updateCount = UINT16_MAX + 2;
+    [self.store bl_performBatchUpdatesForUser:self.userid usingBlock:^(BLWalletTransactionModelsBatch *batch) {
+        
+        for (NSUInteger i = 1; i <= updateCount; i++) {
+            [batch updatePaymentModelVerifyCountWithTransactionIdentifier:model.transactionIdentifier modelVerifyCount:i];
+        }
+        
+    }];
+    
+    BLPaymentTransactionModel *fetchedModel = [[self reloadedStore] bl_fetchPaymentTransactionModelWithTransactionIdentifier:model.transactionIdentifier forUser:self.userid];
+    XCTAssertEqual(fetchedModel.modelVerifyCount, updateCount);
+}
+
+- (void)testCompactionKeepsData {
+    BLPaymentTransactionModel *model = [self modelWithIndex:0];
+    [self.store bl_savePaymentTransactionModels:@[model] forUser:self.userid];
+    NSUInteger updateCount = 19;
+    for (NSUInteger i = 1; i <= updateCount; i++) {
+        [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:model.transactionIdentifier modelVerifyCount:i forUser:self.userid];
+    }
+    
+    XCTAssertGreaterThan([self waitForCheckpointSequence], 0);
+    XCTAssertNil([self.backend dataForKey:[self journalKeyWithSequence:1]]);
+    
+    BLPaymentTransactionModel *fetchedModel = [[self reloadedStore] bl_fetchPaymentTransactionModelWithTransactionIdentifier:model.transactionIdentifier forUser:self.userid];
+    XCTAssertEqualObjects(fetchedModel, model);
+    XCTAssertEqual(fetchedModel.modelVerifyCount, updateCount);
+}
+
+- (void)testRecordWithChecksumMismatchIsDropped {
+    BLPaymentTransactionModel *model0 = [self modelWithIndex:0];
+    BLPaymentTransactionModel *model1 = [self modelWithIndex:1];
+    [self.store bl_savePaymentTransactionModels:@[model0, model1] forUser:self.userid];
+    for (NSUInteger i = 1; i <= 19; i++) {
+        [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:model0.transactionIdentifier modelVerifyCount:i forUser:self.userid];
+    }
+    XCTAssertGreaterThan([self waitForCheckpointSequence], 0);
+    
+    // 记录的 magic 也损坏了, 如果照样解码会走到 NSKeyedUnarchiver 抛出异常.
+    NSString *recordKey = [NSString stringWithFormat:@"%@.record.%@.%@", kBLWalletTransactionModelsStoreTestsKeyPrefix, self.userid, model1.transactionIdentifier];
+    XCTAssertTrue([self.backend setData:[@"damaged record" dataUsingEncoding:NSUTF8StringEncoding] forKey:recordKey]);
+    
+    NSArray<BLPaymentTransactionModel *> *fetchedModels = nil;
+    XCTAssertNoThrow(fetchedModels = [[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil]);
+    XCTAssertEqualObjects(fetchedModels, @[model0]);
+}
+
+- (void)testUndecodableJournalEntryIsQuarantinedAndSkipped {
+    BLPaymentTransactionModel *model0 = [self modelWithIndex:0];
+    BLPaymentTransactionModel *model1 = [self modelWithIndex:1];
+    [self.store bl_savePaymentTransactionModels:@[model0] forUser:self.userid];
+    [self.store bl_savePaymentTransactionModels:@[model1] forUser:self.userid];
+    [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:model0.transactionIdentifier modelVerifyCount:5 forUser:self.userid];
+    
+    NSData *damagedData = [@"damaged journal entry" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([self.backend setData:damagedData forKey:[self journalKeyWithSequence:2]]);
+    
+    // 跳过损坏的日志, 之后的日志照常回放, 只丢掉损坏的那一条日志的修改.
+    BLWalletTransactionModelsStore *store = [self reloadedStore];
+    NSArray<BLPaymentTransactionModel *> *fetchedModels = [store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil];
+    XCTAssertEqualObjects(fetchedModels, @[model0]);
+    XCTAssertEqual(fetchedModels.firstObject.modelVerifyCount, 5);
+    
+    // 损坏的日志隔离保存了一份.
+    NSString *quarantinedKey = [NSString stringWithFormat:@"%@.quarantine.%@.%llu", kBLWalletTransactionModelsStoreTestsKeyPrefix, self.userid, 2ULL];
+    XCTAssertEqualObjects([self.backend dataForKey:quarantinedKey], damagedData);
+    
+    // 之后的追加和删除都能成功, 并且不会覆盖损坏的日志.
+    BLPaymentTransactionModel *model2 = [self modelWithIndex:2];
+    [store bl_savePaymentTransactionModels:@[model2] forUser:self.userid];
+    XCTAssertTrue([store bl_deletePaymentTransactionModelWithTransactionIdentifier:model0.transactionIdentifier forUser:self.userid]);
+    XCTAssertNotNil([self.backend dataForKey:[self journalKeyWithSequence:4]]);
+    XCTAssertNotNil([self.backend dataForKey:[self journalKeyWithSequence:5]]);
+    XCTAssertEqualObjects([store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], @[model2]);
+    XCTAssertEqualObjects([[self reloadedStore] bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], @[model2]);
+}
+
+- (void)testLegacyStoreIsMigratedOnlyOnce {
+    BLPaymentTransactionModel *model = [self modelWithIndex:0];
+    NSString *setKey = [NSString stringWithFormat:@"%@.%@", kBLWalletTransactionModelsStoreTestsKeyPrefix, self.userid];
+    NSData *setData = [NSKeyedArchiver archivedDataWithRootObject:[NSSet setWithObject:[model encodedData]]];
+    XCTAssertTrue([self.backend setData:setData forKey:setKey]);
+    
+    XCTAssertEqualObjects([self.store bl_fetchAllPaymentTransactionModelsForUser:self.userid error:nil], @[model]);
+    XCTAssertNil([self.backend dataForKey:setKey]);
+    [self.store bl_updatePaymentModelVerifyCountWithTransactionIdentifier:model.transactionIdentifier modelVerifyCount:4 forUser:self.userid];
+    
+    // 上次迁移以后删除旧数据失败, 再次加载时不能用旧数据覆盖之后的修改.
+    XCTAssertTrue([self.backend setData:setData forKey:setKey]);
+    BLPaymentTransactionModel *fetchedModel = [[self reloadedStore] bl_fetchPaymentTransactionModelWithTransactionIdentifier:model.transactionIdentifier forUser:self.userid];
+    XCTAssertEqual(fetchedModel.modelVerifyCount, 4);
+    XCTAssertNil([self.backend dataForKey:setKey]);
+}
+
+@end
+
+@interface BLWalletTransactionModelsStoreFileBackendTests : BLWalletTransactionModelsStoreTests
+
+/**
+ * 文件存储的目录, 每个测试单独一个.
+ */
+@property(nonatomic, strong) NSURL *directoryURL;
+
+@end
+
+@implementation BLWalletTransactionModelsStoreFileBackendTests
+
+- (id<BLWalletStorageBackend>)makeBackend {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BLIAPTests/%@", [NSUUID UUID].UUIDString]];
+    self.directoryURL = [NSURL fileURLWithPath:path isDirectory:YES];
+    return [[BLWalletFileStorageBackend alloc] initWithDirectoryURL:self.directoryURL];
+}
+
+- (void)tearDown {
+    [super tearDown];
+    
+    [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+}
+
+- (void)testReadAfterWriteComesFromDisk {
+    NSString *key = @"read-after-write";
+    XCTAssertTrue([self.backend setData:[@"first" dataUsingEncoding:NSUTF8StringEncoding] forKey:key]);
+    XCTAssertNotNil([self.backend dataForKey:key]);
+    XCTAssertTrue([self.backend setData:[@"second" dataUsingEncoding:NSUTF8StringEncoding] forKey:key]);
+    
+    // 写入以后文件在磁盘上被改动了, 回读确认必须能发现, 不能读到写入时缓存的数据.
+    NSData *diskData = [@"changed on disk" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([diskData writeToURL:[self.directoryURL URLByAppendingPathComponent:key isDirectory:NO] atomically:YES]);
+    XCTAssertEqualObjects([self.backend dataForKey:key], diskData);
+}
+
+@end